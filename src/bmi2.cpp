@@ -18,75 +18,39 @@
 #include "slidey.h"
 #include <immintrin.h>
 
-// the nested arrays used to lookup the attacks
-std::array<std::array<uint64_t, 512>, 64> bishopAttackLookup;
-std::array<std::array<uint64_t, 4096>, 64> rookAttackLookup;
-
-int getBishopBlockerCombinations(std::array<uint64_t, 512> &blockers, const uint64_t mask) {
-    // calculates the total amount of possible blocker configuration (2^n)
-    int totalPatterns = 1 << __builtin_popcountll(mask);
-    assert(totalPatterns <= 512);
-
-    // generates them, using pdep
-    for(int i = 0; i < totalPatterns; i++) {
-        blockers[i] = _pdep_u64(i, mask);
-    }
-
-    return totalPatterns;
+// only these are built with bmi2, so that the same binary still runs on cpus without it
+// the whole lookup is in here, since these can't be inlined into code that isn't built with bmi2
+__attribute__((target("bmi2"))) uint64_t pextRookAttacks(const uint64_t occupiedBitboard, const int square) {
+    return pextRookTable[rookOffsets[square] + _pext_u64(occupiedBitboard, rookMasks[square])];
 }
 
-// seperated so that I can have the assertions be right
-int getRookBlockerCombinations(std::array<uint64_t, 4096> &blockers, const uint64_t mask) {
-    // calculates the total amount of possible blocker configuration (2^n)
-    int totalPatterns = 1 << __builtin_popcountll(mask);
-    assert(totalPatterns <= 4096);
-
-    // generates them, using pdep
-    for(int i = 0; i < totalPatterns; i++) {
-        blockers[i] = _pdep_u64(i, mask);
-    }
-
-    return totalPatterns;
+__attribute__((target("bmi2"))) uint64_t pextBishopAttacks(const uint64_t occupiedBitboard, const int square) {
+    return pextBishopTable[bishopOffsets[square] + _pext_u64(occupiedBitboard, bishopMasks[square])];
 }
 
-// generates the lookup tables for each square, ran on startup
-void generateLookups() {
-    // loops through each square
-    for(int i = 0; i < 64; i++) {
-        // generate the different blocker patterns
-        std::array<uint64_t, 4096> rookBlockers;
-        int rookPatterns = getRookBlockerCombinations(rookBlockers, rookMasks[i]);
-
-        // calculate the moves for each one
-        for(int j = 0; j < rookPatterns; j++) {
-            rookAttackLookup[i][calculateRookIndex(rookBlockers[j], i)] = getRookAttacksOld(i, rookBlockers[j]);
-        }
-
-        // bishop blocker patterns
-        std::array<uint64_t, 512> bishopBlockers;
-        int bishopPatterns = getBishopBlockerCombinations(bishopBlockers, bishopMasks[i]);
+// pdep spreads the 16 bits back out over the squares they were taken from
+__attribute__((target("bmi2"))) uint64_t compressedRookAttacks(const uint64_t occupiedBitboard, const int square) {
+    return _pdep_u64(compressedRookTable[rookOffsets[square] + _pext_u64(occupiedBitboard, rookMasks[square])], rookReach[square]);
+}
 
-        // calculate the moves for each one
-        for(int j = 0; j < bishopPatterns; j++) {
-            bishopAttackLookup[i][calculateBishopIndex(bishopBlockers[j], i)] = getBishopAttacksOld(i, bishopBlockers[j]);
-        }
-    }
+__attribute__((target("bmi2"))) uint64_t compressedBishopAttacks(const uint64_t occupiedBitboard, const int square) {
+    return _pdep_u64(compressedBishopTable[bishopOffsets[square] + _pext_u64(occupiedBitboard, bishopMasks[square])], bishopReach[square]);
 }
 
-// uses pext to calculate the index for each square and blockers
-uint64_t calculateRookIndex(const uint64_t occupiedBitboard, const int square) {
-    return _pext_u64(occupiedBitboard, rookMasks[square]);
+__attribute__((target("bmi2"))) uint64_t flatPextRookAttacks(const uint64_t occupiedBitboard, const int square) {
+    return flatRookTable[square][_pext_u64(occupiedBitboard, rookMasks[square])];
 }
 
-uint64_t calculateBishopIndex(const uint64_t occupiedBitboard, const int square) {
-    return _pext_u64(occupiedBitboard, bishopMasks[square]);
+__attribute__((target("bmi2"))) uint64_t flatPextBishopAttacks(const uint64_t occupiedBitboard, const int square) {
+    return flatBishopTable[square][_pext_u64(occupiedBitboard, bishopMasks[square])];
 }
 
-// gets the attacks from the tables so the values don't have to be public
-uint64_t getRookAttacksFromTable(const uint64_t occupiedBitboard, const int square) {
-    return rookAttackLookup[square][calculateRookIndex(occupiedBitboard, square)];
+bool pextIsSupported() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("bmi2");
 }
 
-uint64_t getBishopAttacksFromTable(const uint64_t occupiedBitboard, const int square) {
-    return bishopAttackLookup[square][calculateBishopIndex(occupiedBitboard, square)];
+// zen 1 and 2 (family 17h) and the bulldozer family (15h) have pext, but it's microcoded and much slower than magics there
+bool pextIsFast() {
+    return pextIsSupported() && !__builtin_cpu_is("amdfam15h") && !__builtin_cpu_is("amdfam17h");
 }
@@ -17,11 +17,14 @@
 */
 #include "globals.h"
 #include "corrhist.h"
+#include "slidey.h"
 #include <cstdlib>
+#include <cctype>
 
 template bool Board::makeMove<false>(Move move);
 template void Board::undoMove<false>();
 template bool Board::makeMove<true>(Move move);
+template bool Board::makeMove<true, false>(Move move);
 template void Board::undoMove<true>();
 template void Board::addPiece<false>(int square, int type);
 template void Board::removePiece<false>(int square, int type);
@@ -30,10 +33,124 @@ template void Board::addPiece<true>(int square, int type);
 template void Board::removePiece<true>(int square, int type);
 template void Board::movePiece<true>(int square1, int type1, int square2, int type2);
 
-// zobrist hashing values 
-std::array<std::array<uint64_t, 14>, 64> zobTable;
+// std::mt19937_64, written out so the compiler can run it, since the standard one can't be used in a constexpr
+// it gives exactly the same numbers, so the keys are the same ones the engine has always used
+struct ConstexprMt64 {
+    static constexpr int size = 312;
+    static constexpr int shift = 156;
+    std::array<uint64_t, size> state = {};
+    int index = size;
+
+    constexpr explicit ConstexprMt64(uint64_t seed) {
+        state[0] = seed;
+        for(int i = 1; i < size; i++) {
+            state[i] = 6364136223846793005ULL * (state[i - 1] ^ (state[i - 1] >> 62)) + i;
+        }
+    }
+
+    constexpr void twist() {
+        for(int i = 0; i < size; i++) {
+            const uint64_t x = (state[i] & 0xFFFFFFFF80000000ULL) | (state[(i + 1) % size] & 0x7FFFFFFFULL);
+            state[i] = state[(i + shift) % size] ^ (x >> 1) ^ ((x & 1) ? 0xB5026F5AA96619E9ULL : 0);
+        }
+        index = 0;
+    }
+
+    constexpr uint64_t operator()() {
+        if(index == size) twist();
+        uint64_t y = state[index++];
+        y ^= (y >> 29) & 0x5555555555555555ULL;
+        y ^= (y << 17) & 0x71D67FFFEDA60000ULL;
+        y ^= (y << 37) & 0xFFF7EEE000000000ULL;
+        y ^= y >> 43;
+        return y;
+    }
+};
+
+// the standard says the 10000th number from the default seed has to be this
+static_assert([] {
+    ConstexprMt64 gen(5489);
+    for(int i = 1; i < 10000; i++) gen();
+    return gen();
+}() == 9981545732273789042ULL);
+
+struct ZobristKeys {
+    std::array<std::array<uint64_t, 14>, 64> table;
+    uint64_t colorToMove;
+};
+
+constexpr ZobristKeys generateZobrist() {
+    ZobristKeys keys = {};
+    ConstexprMt64 gen(0xABBABA5ED);
+    // color to move
+    keys.colorToMove = gen();
+    // squares
+    for(int i = 0; i < 64; i++) {
+        for(int j = 0; j < 14; j++) {
+            keys.table[i][j] = gen();
+        }
+    }
+    return keys;
+}
+
+// zobrist hashing values, made by the compiler
+constexpr ZobristKeys zobristKeys = generateZobrist();
+constexpr auto &zobTable = zobristKeys.table;
 // if black is to move this value is xor'ed
-uint64_t zobColorToMove;
+constexpr uint64_t zobColorToMove = zobristKeys.colorToMove;
+
+// every reversible move (a piece other than a pawn going between two squares it could get between on an empty board),
+// by what it does to the zobrist hash, in a cuckoo table so that checking a hash difference is just two lookups
+// used to see that a position from earlier can be reached again in one move, from Marcel van Kervinck's paper on finding upcoming repetitions
+struct CuckooTables {
+    std::array<uint64_t, 8192> keys;
+    // the two squares, lower one in the low 6 bits, 0 where nothing has gone
+    std::array<uint16_t, 8192> squares;
+    int count;
+};
+
+constexpr int cuckooIndex1(const uint64_t key) {
+    return key & 0x1FFF;
+}
+
+constexpr int cuckooIndex2(const uint64_t key) {
+    return (key >> 16) & 0x1FFF;
+}
+
+constexpr CuckooTables generateCuckoo() {
+    CuckooTables tables = {};
+    for(int color = 0; color < 2; color++) {
+        for(int type = Knight; type <= King; type++) {
+            const int piece = (color << 3) | type;
+            for(int square1 = 0; square1 < 64; square1++) {
+                uint64_t reach = type == Knight ? knightAttacks[square1]
+                    : type == King ? kingAttacks[square1]
+                    : (type != Bishop ? rookReach[square1] : 0) | (type != Rook ? bishopReach[square1] : 0);
+                // each pair only once, the move back is the same key
+                reach &= ~((2ULL << square1) - 1);
+                while(reach != 0) {
+                    const int square2 = std::countr_zero(reach);
+                    reach &= reach - 1;
+                    uint64_t key = zobTable[square1][piece] ^ zobTable[square2][piece] ^ zobColorToMove;
+                    uint16_t squares = square1 | (square2 << 6);
+                    // push whatever is in the way over to its other slot, until something lands in an empty one
+                    int index = cuckooIndex1(key);
+                    while(true) {
+                        std::swap(tables.keys[index], key);
+                        std::swap(tables.squares[index], squares);
+                        if(squares == 0) break;
+                        index = index == cuckooIndex1(key) ? cuckooIndex2(key) : cuckooIndex1(key);
+                    }
+                    tables.count++;
+                }
+            }
+        }
+    }
+    return tables;
+}
+
+constexpr CuckooTables cuckoo = generateCuckoo();
+static_assert(cuckoo.count == 3668);
 
 // masks for caslting rights, used to update the castling rights faster after a rook or king move
 constexpr std::array<uint8_t, 64> rookRightMasks = {
@@ -89,36 +206,33 @@ void Board::toString() {
         std::cout << '\n';
     }
     std::cout << "Ply count: " << std::to_string(plyCount) << '\n';
-    std::cout << "Hash: " << std::to_string(stateHistory.back().zobristHash) << '\n';
-    std::cout << "Castling rights: " << std::to_string(stateHistory.back().castlingRights & 1) << std::to_string((stateHistory.back().castlingRights >> 1) & 1) << std::to_string((stateHistory.back().castlingRights >> 2) & 1) << std::to_string((stateHistory.back().castlingRights >> 3) & 1) << '\n';
-    if(stateHistory.back().enPassantIndex == 64) {
+    std::cout << "Hash: " << std::to_string(currentState().zobristHash) << '\n';
+    std::cout << "Castling rights: " << std::to_string(currentState().castlingRights & 1) << std::to_string((currentState().castlingRights >> 1) & 1) << std::to_string((currentState().castlingRights >> 2) & 1) << std::to_string((currentState().castlingRights >> 3) & 1) << '\n';
+    if(currentState().enPassantIndex == 64) {
         std::cout << "En passant square: none\n";
     } else {
-        std::cout << "En passant square: " << squareNames[stateHistory.back().enPassantIndex] << '\n';
+        std::cout << "En passant square: " << squareNames[currentState().enPassantIndex] << '\n';
     }
     std::cout << "Color to move: " << (colorToMove == 0 ? "black" : "white") << '\n';
     std::cout << "Evaluation: " << std::to_string(getEvaluation()) << '\n';
 }
 
 Board::Board(std::string fen) {
-    stateHistory.clear();
-    stateHistory.reserve(256);
-    stateHistory.push_back(BoardState());
+    stateHistory.assign(initialStates, BoardState());
+    stateIndex = 0;
     nnueState.reset();
-    stateHistory.back().zobristHash = 0;
-	stateHistory.back().pawnHash = 0;
-    stateHistory.back().nonPawnHashes[0] = 0;
-    stateHistory.back().nonPawnHashes[1] = 0;
-    stateHistory.back().majorHash = 0;
-    stateHistory.back().minorHash = 0;
-    for(int i = 0; i < 64; i++) {
-        stateHistory.back().mailbox[i] = None;
-    }
+    currentState().zobristHash = 0;
+	currentState().pawnHash = 0;
+    currentState().nonPawnHashes[0] = 0;
+    currentState().nonPawnHashes[1] = 0;
+    currentState().majorHash = 0;
+    currentState().minorHash = 0;
+    mailbox.fill(None);
     for(int i = 0; i < 6; i++) {
-        stateHistory.back().pieceBitboards[i] = 0ULL;
+        currentState().pieceBitboards[i] = 0ULL;
     }
     for(int i = 0; i < 2; i++) {
-        stateHistory.back().coloredBitboards[i] = 0ULL;
+        currentState().coloredBitboards[i] = 0ULL;
     }
     // main board state, segment 1
     std::vector<std::string> segments = split(fen, ' ');
@@ -170,12 +284,12 @@ Board::Board(std::string fen) {
                     break;
                 case 'k':
                     addPiece<false>(i, King | Black);
-                    stateHistory.back().kingSquares[0] = i;
+                    currentState().kingSquares[0] = i;
                     i++;
                     break;
                 case 'K':
                     addPiece<false>(i, King | White);
-                    stateHistory.back().kingSquares[1] = i;
+                    currentState().kingSquares[1] = i;
                     i++;
                     break;
                 default:
@@ -186,18 +300,18 @@ Board::Board(std::string fen) {
     }
     // convert color to move into 0 or 1, segment 2
     colorToMove = (segments[1] == "w" ? 1 : 0);
-    if(colorToMove == 1) stateHistory.back().zobristHash ^= zobColorToMove;
+    if(colorToMove == 1) currentState().zobristHash ^= zobColorToMove;
     // decode the castling rights into the 4 bit number, segment 3
-    stateHistory.back().castlingRights = 0;
+    currentState().castlingRights = 0;
     for(char c : segments[2]) {
         if(c == 'K') {
-            stateHistory.back().castlingRights |= 1;
+            currentState().castlingRights |= 1;
         } else if(c == 'Q') {
-            stateHistory.back().castlingRights |= 2;
+            currentState().castlingRights |= 2;
         } else if(c == 'k') {
-            stateHistory.back().castlingRights |= 4;
+            currentState().castlingRights |= 4;
         } else if(c == 'q') {
-            stateHistory.back().castlingRights |= 8;
+            currentState().castlingRights |= 8;
         }
     }
     // decode the en passant index, segment 4
@@ -212,17 +326,17 @@ Board::Board(std::string fen) {
             }
             i++;
         }
-        stateHistory.back().enPassantIndex = num;
+        currentState().enPassantIndex = num;
     } else {
-        stateHistory.back().enPassantIndex = 64;
+        currentState().enPassantIndex = 64;
     }
     // 50 move counter, segment 5
-    stateHistory.back().hundredPlyCounter = 0;
+    currentState().hundredPlyCounter = 0;
     // ply count, segment 6
     plyCount = std::stoi(segments[5]) * 2 - colorToMove;
-    nnueState.refreshAccumulator(0, stateHistory.back(), stateHistory.back().kingSquares[0]);
-    nnueState.refreshAccumulator(1, stateHistory.back(), stateHistory.back().kingSquares[1]);
-    stateHistory.back().threats = calculateThreats();
+    nnueState.refreshAccumulator(0, currentState(), currentState().kingSquares[0]);
+    nnueState.refreshAccumulator(1, currentState(), currentState().kingSquares[1]);
+    currentState().threatsValid = false;
 }
 
 std::string Board::getFenString() {
@@ -282,33 +396,33 @@ std::string Board::getFenString() {
     // castling rights
     fen += ' ';
     bool thingAdded = false;
-    if((stateHistory.back().castlingRights & 1) != 0) {
+    if((currentState().castlingRights & 1) != 0) {
         fen += 'K'; 
         thingAdded = true;
     }
-    if((stateHistory.back().castlingRights & 2) != 0) {
+    if((currentState().castlingRights & 2) != 0) {
         fen += 'Q'; 
         thingAdded = true;
     }
-    if((stateHistory.back().castlingRights & 4) != 0) {
+    if((currentState().castlingRights & 4) != 0) {
         fen += 'k'; 
         thingAdded = true;
     }
-    if((stateHistory.back().castlingRights & 8) != 0) {
+    if((currentState().castlingRights & 8) != 0) {
         fen += 'q'; 
         thingAdded = true;
     }
     if(thingAdded == false) fen += '-';
     // en passant square
     fen += ' ';
-    if(stateHistory.back().enPassantIndex == 64) {
+    if(currentState().enPassantIndex == 64) {
         fen += '-';
     } else {
-        fen += squareNames[stateHistory.back().enPassantIndex];
+        fen += squareNames[currentState().enPassantIndex];
     }
     // 50 move counter
     fen += ' ';
-    fen += std::to_string(stateHistory.back().hundredPlyCounter / 2);
+    fen += std::to_string(currentState().hundredPlyCounter / 2);
     // ply count
     fen += ' ';
     fen += std::to_string(plyCount / 2 + colorToMove);
@@ -320,22 +434,23 @@ template <bool UpdateNNUE> void Board::addPiece(int square, int type) {
     assert(square < 64);
     assert(pieceAtIndex(square) == None);
     assert(square >= 0);
+    BoardState &state = currentState();
     const uint64_t bitboardSquare = squareToBitboard[square];
     //std::cout << "Adding piece of type " << std::to_string(type) << " at index " << std::to_string(square) << '\n';
-    stateHistory.back().coloredBitboards[getColor(type)] ^= bitboardSquare;
-    stateHistory.back().pieceBitboards[getType(type)] ^= bitboardSquare;
-    stateHistory.back().mailbox[square] = type;
+    state.coloredBitboards[getColor(type)] ^= bitboardSquare;
+    state.pieceBitboards[getType(type)] ^= bitboardSquare;
+    mailbox[square] = type;
     assert(pieceAtIndex(square) == type);
-    if constexpr(UpdateNNUE) nnueState.activateFeature(square, type, stateHistory.back().kingSquares[0], stateHistory.back().kingSquares[1]);
-    stateHistory.back().zobristHash ^= zobTable[square][type];
+    if constexpr(UpdateNNUE) nnueState.activateFeature(square, type, state.kingSquares[0], state.kingSquares[1]);
+    state.zobristHash ^= zobTable[square][type];
     if(getType(type) == Pawn) {
-        stateHistory.back().pawnHash ^= zobTable[square][type];
+        state.pawnHash ^= zobTable[square][type];
     } else {
-        stateHistory.back().nonPawnHashes[getColor(type)] ^= zobTable[square][type];
+        state.nonPawnHashes[getColor(type)] ^= zobTable[square][type];
         if(getType(type) == Queen || getType(type) == Rook) {
-            stateHistory.back().majorHash ^= zobTable[square][type];
+            state.majorHash ^= zobTable[square][type];
         } else if(getType(type) != King) {
-            stateHistory.back().minorHash ^= zobTable[square][type];
+            state.minorHash ^= zobTable[square][type];
         }
     }
 }
@@ -345,20 +460,21 @@ template <bool UpdateNNUE> void Board::removePiece(int square, int type) {
     assert(square < 64);
     assert(pieceAtIndex(square) == type);
     assert(square >= 0);
+    BoardState &state = currentState();
     const uint64_t bitboardSquare = squareToBitboard[square];
-    stateHistory.back().coloredBitboards[getColor(type)] ^= bitboardSquare;
-    stateHistory.back().pieceBitboards[getType(type)] ^= bitboardSquare;
-    stateHistory.back().mailbox[square] = None;
-    if constexpr(UpdateNNUE) nnueState.disableFeature(square, type, stateHistory.back().kingSquares[0], stateHistory.back().kingSquares[1]);
-    stateHistory.back().zobristHash ^= zobTable[square][type];
+    state.coloredBitboards[getColor(type)] ^= bitboardSquare;
+    state.pieceBitboards[getType(type)] ^= bitboardSquare;
+    mailbox[square] = None;
+    if constexpr(UpdateNNUE) nnueState.disableFeature(square, type, state.kingSquares[0], state.kingSquares[1]);
+    state.zobristHash ^= zobTable[square][type];
     if(getType(type) == Pawn) {
-        stateHistory.back().pawnHash ^= zobTable[square][type];
+        state.pawnHash ^= zobTable[square][type];
     } else {
-        stateHistory.back().nonPawnHashes[getColor(type)] ^= zobTable[square][type];
+        state.nonPawnHashes[getColor(type)] ^= zobTable[square][type];
         if(getType(type) == Queen || getType(type) == Rook) {
-            stateHistory.back().majorHash ^= zobTable[square][type];
+            state.majorHash ^= zobTable[square][type];
         } else if(getType(type) != King) {
-            stateHistory.back().minorHash ^= zobTable[square][type];
+            state.minorHash ^= zobTable[square][type];
         }
     }
     assert(pieceAtIndex(square) == None);
@@ -374,18 +490,18 @@ template <bool UpdateNNUE> void Board::movePiece(int square1, int type1, int squ
 }
 
 int Board::pieceAtIndex(int index) const {
-    return stateHistory.back().mailbox[index];
+    return mailbox[index];
 }
 int Board::colorAtIndex(int index) const {
-    return stateHistory.back().mailbox[index] == None ? 2 : getColor(stateHistory.back().mailbox[index]);
+    return mailbox[index] == None ? 2 : getColor(mailbox[index]);
 }
 
 uint64_t Board::getColoredPieceBitboard(int color, int piece) const {
-    return stateHistory.back().pieceBitboards[piece] & stateHistory.back().coloredBitboards[color];
+    return currentState().pieceBitboards[piece] & currentState().coloredBitboards[color];
 }
 
 uint64_t Board::getOccupiedBitboard() const {
-    return stateHistory.back().coloredBitboards[0] | stateHistory.back().coloredBitboards[1];
+    return currentState().coloredBitboards[0] | currentState().coloredBitboards[1];
 }
 
 // fills up the array and then returns the number of moves to be looped through later.
@@ -393,30 +509,30 @@ int Board::getMoves(std::array<Move, 256> &moves) const {
     uint64_t occupiedBitboard = getOccupiedBitboard();
     int totalMoves = 0;
     // castling
-    if((stateHistory.back().castlingRights & kingRightMasks[1 - colorToMove]) != 0) {
+    if((currentState().castlingRights & kingRightMasks[1 - colorToMove]) != 0) {
         if(!isInCheck()) {
             if(colorToMove == 1) {
-                if((stateHistory.back().castlingRights & 1) != 0 && (occupiedBitboard & 0x60) == 0 && !squareIsUnderAttack(5)) {
+                if((currentState().castlingRights & 1) != 0 && (occupiedBitboard & 0x60) == 0 && !squareIsUnderAttack(5)) {
                     moves[totalMoves] = Move(4, 6, castling[0]);
                     totalMoves++;
                 }
-                if((stateHistory.back().castlingRights & 2) != 0 && (occupiedBitboard & 0xE) == 0 && !squareIsUnderAttack(3)) {
+                if((currentState().castlingRights & 2) != 0 && (occupiedBitboard & 0xE) == 0 && !squareIsUnderAttack(3)) {
                     moves[totalMoves] = Move(4, 2, castling[1]);
                     totalMoves++;
                 }
             } else {
-                if((stateHistory.back().castlingRights & 4) != 0 && (occupiedBitboard & 0x6000000000000000) == 0 && !squareIsUnderAttack(61)) {
+                if((currentState().castlingRights & 4) != 0 && (occupiedBitboard & 0x6000000000000000) == 0 && !squareIsUnderAttack(61)) {
                     moves[totalMoves] = Move(60, 62, castling[2]);
                     totalMoves++;
                 }
-                if((stateHistory.back().castlingRights & 8) != 0 && (occupiedBitboard & 0xE00000000000000) == 0 && !squareIsUnderAttack(59)) {
+                if((currentState().castlingRights & 8) != 0 && (occupiedBitboard & 0xE00000000000000) == 0 && !squareIsUnderAttack(59)) {
                     moves[totalMoves] = Move(60, 58, castling[3]);
                     totalMoves++; 
                 }
             }
         }
     }
-    uint64_t mask = stateHistory.back().coloredBitboards[colorToMove] ^ getColoredPieceBitboard(colorToMove, Pawn);
+    uint64_t mask = currentState().coloredBitboards[colorToMove] ^ getColoredPieceBitboard(colorToMove, Pawn);
     // the rest of the pieces
     while(mask != 0) {
         uint8_t startSquare = popLSB(mask);
@@ -434,7 +550,7 @@ int Board::getMoves(std::array<Move, 256> &moves) const {
             total = getKingAttacks(startSquare);
         }
         // get rid of capturing your own pieces
-        total ^= (total & stateHistory.back().coloredBitboards[colorToMove]); 
+        total ^= (total & currentState().coloredBitboards[colorToMove]); 
         while(total != 0) {
             moves[totalMoves] = Move(startSquare, popLSB(total), Normal);
             totalMoves++;
@@ -469,9 +585,9 @@ int Board::getMoves(std::array<Move, 256> &moves) const {
         }
     }
     // pawn captures
-    uint64_t capturable = stateHistory.back().coloredBitboards[1 - colorToMove];
-    if(stateHistory.back().enPassantIndex != 64) {
-        capturable |= squareToBitboard[stateHistory.back().enPassantIndex];
+    uint64_t capturable = currentState().coloredBitboards[1 - colorToMove];
+    if(currentState().enPassantIndex != 64) {
+        capturable |= squareToBitboard[currentState().enPassantIndex];
     }
 
     uint64_t leftCaptures = (colorToMove == 0 ? pawnBitboard >> 9 : pawnBitboard << 7);
@@ -489,13 +605,13 @@ int Board::getMoves(std::array<Move, 256> &moves) const {
     while(leftCaptures != 0) {
         int index = popLSB(leftCaptures);
         int startSquare = index + (colorToMove == 0 ? 9 : -7);
-        moves[totalMoves] = Move(startSquare, index, (index == stateHistory.back().enPassantIndex ? EnPassant : Normal));
+        moves[totalMoves] = Move(startSquare, index, (index == currentState().enPassantIndex ? EnPassant : Normal));
         totalMoves++;
     }
     while(rightCaptures != 0) {
         int index = popLSB(rightCaptures);
         int startSquare = index + (colorToMove == 0 ? 7 : -9);
-        moves[totalMoves] = Move(startSquare, index, (index == stateHistory.back().enPassantIndex ? EnPassant : Normal));
+        moves[totalMoves] = Move(startSquare, index, (index == currentState().enPassantIndex ? EnPassant : Normal));
         totalMoves++;
     }
     while(leftCapturePromotions != 0) {
@@ -520,7 +636,7 @@ int Board::getMoves(std::array<Move, 256> &moves) const {
 int Board::getMovesQSearch(std::array<Move, 256> &moves) const {
     const uint64_t occupiedBitboard = getOccupiedBitboard();
     int totalMoves = 0;
-    uint64_t mask = stateHistory.back().coloredBitboards[colorToMove] ^ getColoredPieceBitboard(colorToMove, Pawn);
+    uint64_t mask = currentState().coloredBitboards[colorToMove] ^ getColoredPieceBitboard(colorToMove, Pawn);
     // the rest of the pieces
     while(mask != 0) {
         const uint8_t startSquare = popLSB(mask);
@@ -538,7 +654,7 @@ int Board::getMovesQSearch(std::array<Move, 256> &moves) const {
             total = getKingAttacks(startSquare);
         }
         // Only captures or (not done yet) checks
-        total &= stateHistory.back().coloredBitboards[1 - colorToMove]; 
+        total &= currentState().coloredBitboards[1 - colorToMove]; 
         while(total != 0) {
             moves[totalMoves] = Move(startSquare, popLSB(total), Normal);
             totalMoves++;
@@ -559,9 +675,9 @@ int Board::getMovesQSearch(std::array<Move, 256> &moves) const {
     }
 
     // captures
-    uint64_t capturable = stateHistory.back().coloredBitboards[1 - colorToMove];
-    if(stateHistory.back().enPassantIndex != 64) {
-        capturable |= squareToBitboard[stateHistory.back().enPassantIndex];
+    uint64_t capturable = currentState().coloredBitboards[1 - colorToMove];
+    if(currentState().enPassantIndex != 64) {
+        capturable |= squareToBitboard[currentState().enPassantIndex];
     }
 
     uint64_t leftCaptures = (colorToMove == 0 ? pawnBitboard >> 9 : pawnBitboard << 7);
@@ -579,13 +695,13 @@ int Board::getMovesQSearch(std::array<Move, 256> &moves) const {
     while(leftCaptures != 0) {
         int index = popLSB(leftCaptures);
         int startSquare = index + (colorToMove == 0 ? 9 : -7);
-        moves[totalMoves] = Move(startSquare, index, (index == stateHistory.back().enPassantIndex ? EnPassant : Normal));
+        moves[totalMoves] = Move(startSquare, index, (index == currentState().enPassantIndex ? EnPassant : Normal));
         totalMoves++;
     }
     while(rightCaptures != 0) {
         int index = popLSB(rightCaptures);
         int startSquare = index + (colorToMove == 0 ? 7 : -9);
-        moves[totalMoves] = Move(startSquare, index, (index == stateHistory.back().enPassantIndex ? EnPassant : Normal));
+        moves[totalMoves] = Move(startSquare, index, (index == currentState().enPassantIndex ? EnPassant : Normal));
         totalMoves++;
     }
     while(leftCapturePromotions != 0) {
@@ -607,54 +723,313 @@ int Board::getMovesQSearch(std::array<Move, 256> &moves) const {
     return totalMoves;
 }
 
+// works out which pieces are pinned and what has to be done about a check once, and then only generates moves that fit both
+// the moves come out in the same order getMoves would give them, so the move ordering ties break the same way
+int Board::getLegalMoves(std::array<Move, 256> &moves) const {
+    const BoardState &state = currentState();
+    const int king = state.kingSquares[colorToMove];
+    const uint64_t occupiedBitboard = getOccupiedBitboard();
+    const uint64_t ours = state.coloredBitboards[colorToMove];
+    const uint64_t theirs = state.coloredBitboards[1 - colorToMove];
+    const uint64_t rookSliders = (state.pieceBitboards[Rook] | state.pieceBitboards[Queen]) & theirs;
+    const uint64_t bishopSliders = (state.pieceBitboards[Bishop] | state.pieceBitboards[Queen]) & theirs;
+    int totalMoves = 0;
+
+    const uint64_t checkers = getAttackers(king) & theirs;
+    // the king is taken off the board for this, otherwise stepping straight back from a slider would look safe
+    // only a few squares ever get asked about, which is cheaper than working out everything they attack
+    const uint64_t withoutKing = occupiedBitboard ^ (1ULL << king);
+    const auto isSafe = [&](int square) {
+        return ((getRookAttacks(square, withoutKing) & rookSliders)
+            | (getBishopAttacks(square, withoutKing) & bishopSliders)
+            | (getKnightAttacks(square) & state.pieceBitboards[Knight] & theirs)
+            | (getPawnAttacks(square, colorToMove) & state.pieceBitboards[Pawn] & theirs)
+            | (getKingAttacks(square) & state.pieceBitboards[King] & theirs)) == 0;
+    };
+
+    // everything but the king has to capture the checker or get in its way
+    uint64_t targets = ~ours;
+    if(checkers != 0) {
+        targets = getBetween(king, std::countr_zero(checkers)) | checkers;
+    } else if((state.castlingRights & kingRightMasks[1 - colorToMove]) != 0) {
+        // not being in check means nothing was looking through the king, so taking it off doesn't matter for the squares it passes over
+        if(colorToMove == 1) {
+            if((state.castlingRights & 1) != 0 && (occupiedBitboard & 0x60) == 0 && isSafe(5) && isSafe(6)) {
+                moves[totalMoves] = Move(4, 6, castling[0]);
+                totalMoves++;
+            }
+            if((state.castlingRights & 2) != 0 && (occupiedBitboard & 0xE) == 0 && isSafe(3) && isSafe(2)) {
+                moves[totalMoves] = Move(4, 2, castling[1]);
+                totalMoves++;
+            }
+        } else {
+            if((state.castlingRights & 4) != 0 && (occupiedBitboard & 0x6000000000000000) == 0 && isSafe(61) && isSafe(62)) {
+                moves[totalMoves] = Move(60, 62, castling[2]);
+                totalMoves++;
+            }
+            if((state.castlingRights & 8) != 0 && (occupiedBitboard & 0xE00000000000000) == 0 && isSafe(59) && isSafe(58)) {
+                moves[totalMoves] = Move(60, 58, castling[3]);
+                totalMoves++;
+            }
+        }
+    }
+
+    // pins, found by looking out from the king through our own pieces at their sliders
+    // a pinned piece can only move along the line between the king and whatever is pinning it
+    uint64_t pinned = 0;
+    std::array<uint64_t, 64> pinRays;
+    uint64_t snipers = (getRookAttacks(king, theirs) & rookSliders) | (getBishopAttacks(king, theirs) & bishopSliders);
+    while(snipers != 0) {
+        const int sniper = popLSB(snipers);
+        const uint64_t between = getBetween(king, sniper);
+        const uint64_t blockers = between & occupiedBitboard;
+        if(std::popcount(blockers) == 1 && (blockers & ours) != 0) {
+            pinned |= blockers;
+            pinRays[std::countr_zero(blockers)] = between | (1ULL << sniper);
+        }
+    }
+    const auto allowed = [&](int startSquare, int endSquare) {
+        return ((pinned >> startSquare) & 1) == 0 || ((pinRays[startSquare] >> endSquare) & 1) != 0;
+    };
+
+    // only the king can get out of a double check
+    const bool doubleCheck = std::popcount(checkers) > 1;
+    uint64_t mask = doubleCheck ? (1ULL << king) : ours ^ getColoredPieceBitboard(colorToMove, Pawn);
+    while(mask != 0) {
+        const int startSquare = popLSB(mask);
+        const int currentType = getType(pieceAtIndex(startSquare));
+        uint64_t total = 0;
+        if(currentType == Knight) {
+            total = getKnightAttacks(startSquare);
+        } else if(currentType == Bishop) {
+            total = getBishopAttacks(startSquare, occupiedBitboard);
+        } else if(currentType == Rook) {
+            total = getRookAttacks(startSquare, occupiedBitboard);
+        } else if(currentType == Queen) {
+            total = getRookAttacks(startSquare, occupiedBitboard) | getBishopAttacks(startSquare, occupiedBitboard);
+        }
+        if(currentType == King) {
+            total = getKingAttacks(startSquare) & ~ours;
+            while(total != 0) {
+                const int endSquare = popLSB(total);
+                if(!isSafe(endSquare)) continue;
+                moves[totalMoves] = Move(startSquare, endSquare, Normal);
+                totalMoves++;
+            }
+            continue;
+        }
+        total &= targets;
+        if((pinned >> startSquare) & 1) total &= pinRays[startSquare];
+        while(total != 0) {
+            moves[totalMoves] = Move(startSquare, popLSB(total), Normal);
+            totalMoves++;
+        }
+    }
+    if(doubleCheck) return totalMoves;
+
+    // pawn pushes
+    const uint64_t pawnBitboard = getColoredPieceBitboard(colorToMove, Pawn);
+    const uint64_t emptyBitboard = ~occupiedBitboard;
+    uint64_t pawnPushes = getPawnPushes(pawnBitboard, emptyBitboard, colorToMove);
+    // a double push can block a check even when the single push behind it can't
+    uint64_t doublePawnPushes = getDoublePawnPushes(pawnPushes, emptyBitboard, colorToMove) & targets;
+    pawnPushes &= targets;
+    uint64_t pawnPushPromotions = pawnPushes & getRankMask(7 * colorToMove);
+    pawnPushes ^= pawnPushPromotions;
+    while(pawnPushes != 0) {
+        const int index = popLSB(pawnPushes);
+        const int startSquare = index + directionalOffsets[colorToMove];
+        if(!allowed(startSquare, index)) continue;
+        moves[totalMoves] = Move(startSquare, index, Normal);
+        totalMoves++;
+    }
+    while(doublePawnPushes != 0) {
+        const int index = popLSB(doublePawnPushes);
+        const int startSquare = index + directionalOffsets[colorToMove] * 2;
+        if(!allowed(startSquare, index)) continue;
+        moves[totalMoves] = Move(startSquare, index, DoublePawnPush);
+        totalMoves++;
+    }
+    while(pawnPushPromotions != 0) {
+        const int index = popLSB(pawnPushPromotions);
+        const int startSquare = index + directionalOffsets[colorToMove];
+        if(!allowed(startSquare, index)) continue;
+        for(int type = Knight; type < King; type++) {
+            moves[totalMoves] = Move(startSquare, index, promotions[type-1]);
+            totalMoves++;
+        }
+    }
+
+    // pawn captures
+    // en passant takes two pieces off the same rank at once, which the pins can't see, so it gets checked on its own
+    const int enPassantIndex = state.enPassantIndex;
+    const auto enPassantIsLegal = [&](int startSquare) {
+        const int victim = enPassantIndex + directionalOffsets[colorToMove];
+        const uint64_t after = (occupiedBitboard ^ (1ULL << startSquare) ^ (1ULL << victim)) | (1ULL << enPassantIndex);
+        // a knight or pawn giving check, other than the one being taken, is still there afterwards
+        if((checkers & ~(rookSliders | bishopSliders) & ~(1ULL << victim)) != 0) return false;
+        return (getRookAttacks(king, after) & rookSliders) == 0 && (getBishopAttacks(king, after) & bishopSliders) == 0;
+    };
+    uint64_t capturable = theirs & targets;
+    if(enPassantIndex != 64) {
+        capturable |= squareToBitboard[enPassantIndex];
+    }
+
+    uint64_t leftCaptures = (colorToMove == 0 ? pawnBitboard >> 9 : pawnBitboard << 7);
+    leftCaptures &= ~getFileMask(7);
+    leftCaptures &= capturable;
+    uint64_t leftCapturePromotions = leftCaptures & getRankMask(7 * colorToMove);
+    leftCaptures ^= leftCapturePromotions;
+
+    uint64_t rightCaptures = (colorToMove == 0 ? pawnBitboard >> 7 : pawnBitboard << 9);
+    rightCaptures &= ~getFileMask(0);
+    rightCaptures &= capturable;
+    uint64_t rightCapturePromotions = rightCaptures & getRankMask(7 * colorToMove);
+    rightCaptures ^= rightCapturePromotions;
+
+    const auto addCaptures = [&](uint64_t captures, int offset) {
+        while(captures != 0) {
+            const int index = popLSB(captures);
+            const int startSquare = index + offset;
+            if(index == enPassantIndex) {
+                if(!enPassantIsLegal(startSquare)) continue;
+                moves[totalMoves] = Move(startSquare, index, EnPassant);
+            } else {
+                if(!allowed(startSquare, index)) continue;
+                moves[totalMoves] = Move(startSquare, index, Normal);
+            }
+            totalMoves++;
+        }
+    };
+    const auto addCapturePromotions = [&](uint64_t captures, int offset) {
+        while(captures != 0) {
+            const int index = popLSB(captures);
+            const int startSquare = index + offset;
+            if(!allowed(startSquare, index)) continue;
+            for(int type = Knight; type < King; type++) {
+                moves[totalMoves] = Move(startSquare, index, promotions[type-1]);
+                totalMoves++;
+            }
+        }
+    };
+    addCaptures(leftCaptures, colorToMove == 0 ? 9 : -7);
+    addCaptures(rightCaptures, colorToMove == 0 ? 7 : -9);
+    addCapturePromotions(leftCapturePromotions, colorToMove == 0 ? 9 : -7);
+    addCapturePromotions(rightCapturePromotions, colorToMove == 0 ? 7 : -9);
+    return totalMoves;
+}
+
+// the pieces of ours that are the only thing between one of their sliders and our king
+uint64_t Board::getPinned() const {
+    const BoardState &state = currentState();
+    const int king = state.kingSquares[colorToMove];
+    const uint64_t ours = state.coloredBitboards[colorToMove];
+    const uint64_t theirs = state.coloredBitboards[1 - colorToMove];
+    const uint64_t rookSliders = (state.pieceBitboards[Rook] | state.pieceBitboards[Queen]) & theirs;
+    const uint64_t bishopSliders = (state.pieceBitboards[Bishop] | state.pieceBitboards[Queen]) & theirs;
+    uint64_t pinned = 0;
+    uint64_t snipers = (getRookAttacks(king, theirs) & rookSliders) | (getBishopAttacks(king, theirs) & bishopSliders);
+    while(snipers != 0) {
+        const uint64_t blockers = getBetween(king, popLSB(snipers)) & getOccupiedBitboard();
+        if(std::popcount(blockers) == 1 && (blockers & ours) != 0) pinned |= blockers;
+    }
+    return pinned;
+}
+
+uint64_t Board::getCheckers() const {
+    return getAttackers(currentState().kingSquares[colorToMove]) & currentState().coloredBitboards[1 - colorToMove];
+}
+
+// the same rules getLegalMoves follows, but for one pseudolegal move at a time, so a movepicker can throw out the illegal ones without playing them
+// pinned and checkers come from getPinned and getCheckers, which only need working out once per position
+bool Board::isLegal(const Move move, const uint64_t pinned, const uint64_t checkers) const {
+    const BoardState &state = currentState();
+    const int king = state.kingSquares[colorToMove];
+    const int start = move.getStartSquare();
+    const int end = move.getEndSquare();
+    const uint64_t theirs = state.coloredBitboards[1 - colorToMove];
+    const uint64_t rookSliders = (state.pieceBitboards[Rook] | state.pieceBitboards[Queen]) & theirs;
+    const uint64_t bishopSliders = (state.pieceBitboards[Bishop] | state.pieceBitboards[Queen]) & theirs;
+
+    // the king just needs somewhere safe to go, with it taken off so it can't hide behind itself
+    // castling has already had the square it passes over checked when it was generated
+    if(start == king) {
+        const uint64_t withoutKing = getOccupiedBitboard() ^ (1ULL << king);
+        return ((getRookAttacks(end, withoutKing) & rookSliders)
+            | (getBishopAttacks(end, withoutKing) & bishopSliders)
+            | (getKnightAttacks(end) & state.pieceBitboards[Knight] & theirs)
+            | (getPawnAttacks(end, colorToMove) & state.pieceBitboards[Pawn] & theirs)
+            | (getKingAttacks(end) & state.pieceBitboards[King] & theirs)) == 0;
+    }
+    // en passant takes two pieces off the same rank, so the board after it gets looked at directly
+    if(move.getFlag() == EnPassant) {
+        const int victim = end + directionalOffsets[colorToMove];
+        const uint64_t after = (getOccupiedBitboard() ^ (1ULL << start) ^ (1ULL << victim)) | (1ULL << end);
+        if((checkers & ~(rookSliders | bishopSliders) & ~(1ULL << victim)) != 0) return false;
+        return (getRookAttacks(king, after) & rookSliders) == 0 && (getBishopAttacks(king, after) & bishopSliders) == 0;
+    }
+    if(checkers != 0) {
+        if(std::popcount(checkers) > 1) return false;
+        if(((getBetween(king, std::countr_zero(checkers)) | checkers) & (1ULL << end)) == 0) return false;
+    }
+    // a pinned piece has to stay on the line, so either it ends up between the king and where it started, or it started between the king and where it ends up
+    return ((pinned >> start) & 1) == 0
+        || ((getBetween(king, end) >> start) & 1) != 0
+        || ((getBetween(king, start) >> end) & 1) != 0;
+}
+
 uint8_t Board::getColorToMove() const {
     return colorToMove;
 }
 
+// checking one square is a lot cheaper than working out every threat, so this only uses them if they're already there
 bool Board::isInCheck() const {
-    return squareIsUnderAttack(stateHistory.back().kingSquares[colorToMove]);
+    const int king = currentState().kingSquares[colorToMove];
+    if(currentState().threatsValid) {
+        return (currentState().threats & (1ULL << king)) != 0;
+    }
+    return isAttackedBy(king, 1 - colorToMove);
 }
 
-// thanks ciekce, shoutout stormphrax
 bool Board::squareIsUnderAttack(int square) const {
-    if(stateHistory.back().threats != 0) {
-        return (stateHistory.back().threats & (1ULL << square));
-    } else {
-        const auto opponent = 1 - colorToMove;
+    return (getThreats() & (1ULL << square)) != 0;
+}
 
-        const auto queens = getColoredPieceBitboard(opponent, Queen);
+// thanks ciekce, shoutout stormphrax
+bool Board::isAttackedBy(int square, int opponent) const {
+    const auto queens = getColoredPieceBitboard(opponent, Queen);
 
-        uint64_t mask = (getRookAttacks(square, getOccupiedBitboard()) & (queens | getColoredPieceBitboard(opponent, Rook)));
-        if(mask != 0)
-            return true;
+    uint64_t mask = (getRookAttacks(square, getOccupiedBitboard()) & (queens | getColoredPieceBitboard(opponent, Rook)));
+    if(mask != 0)
+        return true;
 
-        mask = (getBishopAttacks(square, getOccupiedBitboard()) & (queens | getColoredPieceBitboard(opponent, Bishop)));
-        if(mask != 0)
-            return true;
+    mask = (getBishopAttacks(square, getOccupiedBitboard()) & (queens | getColoredPieceBitboard(opponent, Bishop)));
+    if(mask != 0)
+        return true;
 
-        mask = getKnightAttacks(square) & getColoredPieceBitboard(opponent, Knight);
-        if(mask != 0)
-            return true;
+    mask = getKnightAttacks(square) & getColoredPieceBitboard(opponent, Knight);
+    if(mask != 0)
+        return true;
 
-        mask = getPawnAttacks(square, colorToMove) & getColoredPieceBitboard(opponent, Pawn);
-        if(mask != 0)
-            return true;
+    mask = getPawnAttacks(square, 1 - opponent) & getColoredPieceBitboard(opponent, Pawn);
+    if(mask != 0)
+        return true;
 
-        mask = getKingAttacks(square) & getColoredPieceBitboard(opponent, King);
-        if(mask != 0)
-            return true;
+    mask = getKingAttacks(square) & getColoredPieceBitboard(opponent, King);
+    if(mask != 0)
+        return true;
 
-        return false;
-    }
+    return false;
 }
 
-template <bool PushNNUE> bool Board::makeMove(Move move) {
+template <bool PushNNUE, bool CheckLegality> bool Board::makeMove(Move move) {
     //std::cout << "move " << toLongAlgebraic(move) << " on position " << getFenString() << std::endl;
     //std::cout << "makemove " << toLongAlgebraic(move) << std::endl;
     // push to vectors
-    stateHistory.push_back(stateHistory.back());
+    pushState();
+    BoardState &state = currentState();
     NetworkUpdates updates;
-    stateHistory.back().threats = 0;
+    state.threatsValid = false;
 
     // get information
     int start = move.getStartSquare();
@@ -662,20 +1037,23 @@ template <bool PushNNUE> bool Board::makeMove(Move move) {
     int movedPiece = pieceAtIndex(move.getStartSquare());
     int victim = pieceAtIndex(move.getEndSquare());
     int flag = move.getFlag();
+    state.move = move;
+    state.movedPiece = movedPiece;
+    state.capturedPiece = victim;
     assert(movedPiece != None);
     bool isCapture = victim != None;
     int movedPieceType = getType(movedPiece);
     
     // hundred Ply (fifty move) counter
-    stateHistory.back().hundredPlyCounter++;
+    state.hundredPlyCounter++;
     if(isCapture || movedPieceType == Pawn) {
-        stateHistory.back().hundredPlyCounter = 0;
+        state.hundredPlyCounter = 0;
     }
 
     // king square updates
     if(movedPieceType == King) {
         if(refreshRequired(colorToMove, start, end)) updates.pushBucket(end, colorToMove);
-        stateHistory.back().kingSquares[colorToMove] = end;
+        state.kingSquares[colorToMove] = end;
     }
 
     // actually make the move
@@ -691,16 +1069,16 @@ template <bool PushNNUE> bool Board::makeMove(Move move) {
     }
 
     // En Passant
-    stateHistory.back().enPassantIndex = 64;
+    state.enPassantIndex = 64;
     
     // castling rights updates!
-    if((stateHistory.back().castlingRights & kingRightMasks[1 - colorToMove]) != 0) {
+    if((state.castlingRights & kingRightMasks[1 - colorToMove]) != 0) {
         switch(movedPieceType) {
             case Rook:
-                stateHistory.back().castlingRights &= rookRightMasks[start];
+                state.castlingRights &= rookRightMasks[start];
                 break;
             case King:
-                stateHistory.back().castlingRights &= kingRightMasks[colorToMove];
+                state.castlingRights &= kingRightMasks[colorToMove];
                 break;
             default:
                 break;
@@ -709,16 +1087,16 @@ template <bool PushNNUE> bool Board::makeMove(Move move) {
     if(getType(victim) == Rook) {
         switch(end) {
             case 7:
-                stateHistory.back().castlingRights &= rookRightMasks[end];
+                state.castlingRights &= rookRightMasks[end];
                 break;
             case 0:
-                stateHistory.back().castlingRights &= rookRightMasks[end];
+                state.castlingRights &= rookRightMasks[end];
                 break;
             case 63:
-                stateHistory.back().castlingRights &= rookRightMasks[end];
+                state.castlingRights &= rookRightMasks[end];
                 break;
             case 56:
-                stateHistory.back().castlingRights &= rookRightMasks[end];
+                state.castlingRights &= rookRightMasks[end];
                 break;
             default:
                 break;
@@ -754,7 +1132,7 @@ template <bool PushNNUE> bool Board::makeMove(Move move) {
             break;
         // double pawn push
         case DoublePawnPush:
-            stateHistory.back().enPassantIndex = end + directionalOffsets[colorToMove];
+            state.enPassantIndex = end + directionalOffsets[colorToMove];
             break;
         // en passant
         case EnPassant:
@@ -784,7 +1162,8 @@ template <bool PushNNUE> bool Board::makeMove(Move move) {
     }
     plyCount++;
     // if in check, move was illegal
-    if(isInCheck()) {
+    // moves that were already known to be legal don't need to look for the check
+    if(CheckLegality && isInCheck()) {
         // so you must undo it and return false
         undoMove<false>();
         colorToMove = 1 - colorToMove;
@@ -792,22 +1171,52 @@ template <bool PushNNUE> bool Board::makeMove(Move move) {
         return false;
     } else {
         if constexpr(PushNNUE) {
-            nnueState.performUpdatesAndPush(updates, stateHistory.back().kingSquares[0], stateHistory.back().kingSquares[1], stateHistory.back());
+            nnueState.performUpdatesAndPush(updates, state.kingSquares[0], state.kingSquares[1], state);
         } else {
-            nnueState.performUpdates(updates, stateHistory.back().kingSquares[0], stateHistory.back().kingSquares[1], stateHistory.back());
+            nnueState.performUpdates(updates, state.kingSquares[0], state.kingSquares[1], state);
         }
         // otherwise it's good, move on
         colorToMove = 1 - colorToMove;
-        stateHistory.back().threats = calculateThreats();
         //std::cout << "Changing Color To Move, move was legal\n";
-        stateHistory.back().zobristHash ^= zobColorToMove;
+        state.zobristHash ^= zobColorToMove;
         return true;
     }
 }
 
 template <bool PushNNUE> void Board::undoMove() {
     //std::cout << "undomove\n";
-    stateHistory.pop_back();
+    // the mailbox isn't part of the state, so the move gets played backwards on it
+    const BoardState &undone = currentState();
+    const int start = undone.move.getStartSquare();
+    const int end = undone.move.getEndSquare();
+    mailbox[start] = undone.movedPiece;
+    mailbox[end] = undone.capturedPiece;
+    switch(undone.move.getFlag()) {
+        case castling[0]:
+            mailbox[5] = None;
+            mailbox[7] = Rook | White;
+            break;
+        case castling[1]:
+            mailbox[3] = None;
+            mailbox[0] = Rook | White;
+            break;
+        case castling[2]:
+            mailbox[61] = None;
+            mailbox[63] = Rook | Black;
+            break;
+        case castling[3]:
+            mailbox[59] = None;
+            mailbox[56] = Rook | Black;
+            break;
+        case EnPassant: {
+            const int color = getColor(undone.movedPiece);
+            mailbox[end + directionalOffsets[color]] = Pawn | (8 * !color);
+            break;
+        }
+        default:
+            break;
+    }
+    stateIndex--;
     if constexpr(PushNNUE) nnueState.pop();
     plyCount--;
     colorToMove = 1 - colorToMove;
@@ -817,21 +1226,31 @@ template <bool PushNNUE> void Board::undoMove() {
 }
 
 uint64_t Board::getCurrentPlayerBitboard() const {
-    return stateHistory.back().coloredBitboards[colorToMove];
+    return currentState().coloredBitboards[colorToMove];
+}
+
+// copies the state into the next slot up, the stack only has to grow if a game goes on for longer than it
+void Board::pushState() {
+    if(stateIndex + 1 == std::ssize(stateHistory)) [[unlikely]] {
+        stateHistory.resize(stateHistory.size() * 2);
+    }
+    stateHistory[stateIndex + 1] = stateHistory[stateIndex];
+    stateIndex++;
 }
 
 void Board::changeColor() {
-    stateHistory.push_back(stateHistory.back());
+    pushState();
+    currentState().move = Move();
     nnueState.push();
-    stateHistory.back().enPassantIndex = 64;
-    stateHistory.back().hundredPlyCounter++;
+    currentState().enPassantIndex = 64;
+    currentState().hundredPlyCounter++;
     colorToMove = 1 - colorToMove;
-    stateHistory.back().threats = calculateThreats();
-    stateHistory.back().zobristHash ^= zobColorToMove;
+    currentState().threatsValid = false;
+    currentState().zobristHash ^= zobColorToMove;
 }
 
 void Board::undoChangeColor() {
-    stateHistory.pop_back();
+    stateIndex--;
     nnueState.pop();
     colorToMove = 1 - colorToMove;
 }
@@ -840,41 +1259,92 @@ int Board::getEvaluation() {
     //std::cout << "position fen " << getFenString() << std::endl;
     //std::cout << "evaluate" << std::endl;
     int eval = int(double(nnueState.evaluate(colorToMove, __builtin_popcountll(getOccupiedBitboard()))));
-    //nnueState.fullRefresh(stateHistory.back(), stateHistory.back().kingSquares[0], stateHistory.back().kingSquares[1]);
+    //nnueState.fullRefresh(currentState(), currentState().kingSquares[0], currentState().kingSquares[1]);
     //assert(eval == nnueState.evaluate(colorToMove, __builtin_popcountll(getOccupiedBitboard())));
-    int phase =  3 * __builtin_popcountll(stateHistory.back().pieceBitboards[Knight])
-               + 3 * __builtin_popcountll(stateHistory.back().pieceBitboards[Bishop])
-               + 5 * __builtin_popcountll(stateHistory.back().pieceBitboards[Rook])
-               + 10 * __builtin_popcountll(stateHistory.back().pieceBitboards[Queen]);    
+    return scaleEvaluation(eval, currentState());
+}
+
+// the same, but the network only runs if the cache doesn't already have this position
+// the scaling depends on the 50 move counter, which isn't in the key, so only the raw output is cached
+int Board::getEvaluation(EvalCache &cache) {
+    const uint64_t key = getZobristHash();
+    int eval = 0;
+    if(!cache.probe(key, eval)) {
+        eval = nnueState.evaluate(colorToMove, __builtin_popcountll(getOccupiedBitboard()));
+        cache.store(key, eval);
+    }
+    return scaleEvaluation(eval, currentState());
+}
+
+// scales the network's output down as material comes off the board and as the 50 move counter goes up
+int scaleEvaluation(int eval, const BoardState &state) {
+    int phase =  3 * __builtin_popcountll(state.pieceBitboards[Knight])
+               + 3 * __builtin_popcountll(state.pieceBitboards[Bishop])
+               + 5 * __builtin_popcountll(state.pieceBitboards[Rook])
+               + 10 * __builtin_popcountll(state.pieceBitboards[Queen]);    
 
     eval = eval * (206 + phase) / 256; 
 
-    eval = eval * (200 - stateHistory.back().hundredPlyCounter) / 200;
+    eval = eval * (200 - state.hundredPlyCounter) / 200;
 
     return eval;
 }
 
-int Board::getCastlingRights() const {
-    return stateHistory.back().castlingRights;
+// reads just the piece placement and the side to move, skipping everything a Board would set up, for scoring lots of positions quickly
+// gives back false if the placement doesn't make sense
+bool evaluationStateFromFen(std::string_view fen, BoardState &state, uint8_t &colorToMove) {
+    constexpr std::string_view pieceLetters = "pnbrqk";
+    state = BoardState();
+    std::array<int, 2> kingCount = {0, 0};
+    std::array<int, 2> pieceCount = {0, 0};
+    // the fen starts on a8
+    int square = 56;
+    // how far along the current rank it is, so that a rank with too many squares can't run into the next one
+    int file = 0;
+    size_t i = 0;
+    for(; i < fen.size() && fen[i] != ' '; i++) {
+        const char c = fen[i];
+        if(c == '/') {
+            if(file != 8) return false;
+            square -= 16;
+            file = 0;
+        } else if(c >= '1' && c <= '8') {
+            square += c - '0';
+            file += c - '0';
+            if(file > 8) return false;
+        } else {
+            const size_t type = pieceLetters.find(std::tolower(c));
+            if(type == std::string_view::npos || square < 0 || square > 63 || file >= 8) return false;
+            const int color = std::islower(c) ? 0 : 1;
+            state.pieceBitboards[type] |= 1ULL << square;
+            state.coloredBitboards[color] |= 1ULL << square;
+            if(type == King) {
+                state.kingSquares[color] = square;
+                kingCount[color]++;
+            }
+            pieceCount[color]++;
+            square++;
+            file++;
+        }
+    }
+    // the network has no bucket for more than 32 pieces, and a real game can't get more than 16 a side
+    if(pieceCount[0] > 16 || pieceCount[1] > 16) return false;
+    if(square != 8 || file != 8 || kingCount[0] != 1 || kingCount[1] != 1 || i + 1 >= fen.size()) return false;
+    colorToMove = fen[i + 1] == 'w' ? 1 : 0;
+    return true;
 }
 
-int Board::getEnPassantIndex() const {
-    return stateHistory.back().enPassantIndex;
+std::pair<int, int> Board::checkEvaluation() {
+    const int materialCount = __builtin_popcountll(getOccupiedBitboard());
+    return {nnueState.evaluate(colorToMove, materialCount), nnueState.evaluateFromScratch(currentState(), colorToMove, materialCount)};
 }
 
-void initializeZobrist() {
-    // random number stuff
-    //std::random_device rd;
-    std::mt19937_64 gen(0xABBABA5ED);
-    std::uniform_int_distribution<uint64_t> dis;
-    // color to move
-    zobColorToMove = dis(gen);
-    // squares
-    for(int i = 0; i < 64; i++) {
-        for(int j = 0; j < 14; j++) {
-            zobTable[i][j] = dis(gen);
-        }
-    }
+int Board::getCastlingRights() const {
+    return currentState().castlingRights;
+}
+
+int Board::getEnPassantIndex() const {
+    return currentState().enPassantIndex;
 }
 
 uint64_t Board::fullZobristRegen() {
@@ -896,18 +1366,40 @@ uint64_t Board::fullZobristRegen() {
 }
 
 bool Board::isRepeatedPosition() {
-    int size = std::ssize(stateHistory);
-    for(int i = size - 5; i >= size - stateHistory.back().hundredPlyCounter - 1; i -= 2) {
-        if(stateHistory[i].zobristHash == stateHistory.back().zobristHash) {
+    int size = stateIndex + 1;
+    for(int i = size - 5; i >= size - currentState().hundredPlyCounter - 1; i -= 2) {
+        if(stateHistory[i].zobristHash == currentState().zobristHash) {
             return true;
         }
     }
     return false;
 }
 
+// whether the side to move has a move that gets back to a position from earlier, which counts as a draw the same as isRepeatedPosition
+// only the positions with the other side to move can be one move away, and anything before the last irreversible move can't be reached at all
+bool Board::hasUpcomingRepetition() const {
+    const int end = std::min<int>(currentState().hundredPlyCounter, stateIndex);
+    const uint64_t hash = currentState().zobristHash;
+    for(int i = 3; i <= end; i += 2) {
+        const uint64_t moveKey = hash ^ stateHistory[stateIndex - i].zobristHash;
+        int index = cuckooIndex1(moveKey);
+        if(cuckoo.keys[index] != moveKey) {
+            index = cuckooIndex2(moveKey);
+            if(cuckoo.keys[index] != moveKey) continue;
+        }
+        const int square1 = cuckoo.squares[index] & 63;
+        const int square2 = cuckoo.squares[index] >> 6;
+        // nothing can be in the way, and it has to be the side to move's piece that goes back
+        if((getBetween(square1, square2) & getOccupiedBitboard()) != 0) continue;
+        const int from = mailbox[square1] != None ? square1 : square2;
+        if(getColor(mailbox[from]) == colorToMove) return true;
+    }
+    return false;
+}
+
 bool Board::isLegalMove(const Move& move) {
     std::array<Move, 256> moves;
-    const int totalMoves = getMoves(moves);
+    const int totalMoves = getLegalMoves(moves);
     for(int i = 0; i < totalMoves; i++) {
         if(moves[i] == move) return true;
     }
@@ -918,43 +1410,54 @@ uint64_t Board::getAttackers(int square) const {
     uint64_t occupied = getOccupiedBitboard();
     return (getPawnAttacks(square, 0) & getColoredPieceBitboard(1, Pawn))
         | (getPawnAttacks(square, 1) & getColoredPieceBitboard(0, Pawn))
-        | (getKnightAttacks(square) & stateHistory.back().pieceBitboards[Knight])
-        | (getRookAttacks(square, occupied) & (stateHistory.back().pieceBitboards[Rook] | stateHistory.back().pieceBitboards[Queen]))
-        | (getBishopAttacks(square, occupied) & (stateHistory.back().pieceBitboards[Bishop] | stateHistory.back().pieceBitboards[Queen]))
-        | (getKingAttacks(square) & stateHistory.back().pieceBitboards[King]);
+        | (getKnightAttacks(square) & currentState().pieceBitboards[Knight])
+        | (getRookAttacks(square, occupied) & (currentState().pieceBitboards[Rook] | currentState().pieceBitboards[Queen]))
+        | (getBishopAttacks(square, occupied) & (currentState().pieceBitboards[Bishop] | currentState().pieceBitboards[Queen]))
+        | (getKingAttacks(square) & currentState().pieceBitboards[King]);
 }
 
 uint64_t Board::getColoredBitboard(int color) const {
-    return stateHistory.back().coloredBitboards[color];
+    return currentState().coloredBitboards[color];
 }
 uint64_t Board::getPieceBitboard(int piece) const {
-    return stateHistory.back().pieceBitboards[piece];
+    return currentState().pieceBitboards[piece];
 }
 
 int Board::getFiftyMoveCount() const {
-    return stateHistory.back().hundredPlyCounter / 2;
+    return currentState().hundredPlyCounter / 2;
 }
 
 uint64_t Board::getZobristHash() const {
-    return stateHistory.back().zobristHash;
+    return currentState().zobristHash;
 }
 
 std::array<int, 2> Board::getNonPawnHash() {
-    auto hashes = stateHistory.back().nonPawnHashes;
+    auto hashes = currentState().nonPawnHashes;
     std::array<int, 2> clipped = {int(hashes[0] & Corrhist::mask), int(hashes[1] & Corrhist::mask)};
     return clipped;
 }
 
 BoardState Board::getBoardState() const {
-    return stateHistory.back();
+    return currentState();
 }
 
 Board::Board(BoardState s, int ctm) {
-    stateHistory.push_back(s);
+    stateHistory.assign(initialStates, BoardState());
+    stateIndex = 0;
+    currentState() = s;
     colorToMove = ctm;
-    stateHistory.back().hundredPlyCounter = 0;
+    currentState().hundredPlyCounter = 0;
+    currentState().move = Move();
     plyCount = 0;
-    stateHistory.reserve(256);
+    mailbox.fill(None);
+    for(int color = 0; color < 2; color++) {
+        for(int piece = Pawn; piece < None; piece++) {
+            uint64_t bitboard = s.pieceBitboards[piece] & s.coloredBitboards[color];
+            while(bitboard != 0) {
+                mailbox[popLSB(bitboard)] = piece | (color == 0 ? Black : White);
+            }
+        }
+    }
 }
 
 // estimates the resulting zobrist key from a move
@@ -965,7 +1468,7 @@ uint64_t Board::keyAfter(const Move move) const {
     const int moving = pieceAtIndex(startSquare);
     const int captured = pieceAtIndex(endSquare);
 
-    uint64_t key = stateHistory.back().zobristHash;
+    uint64_t key = currentState().zobristHash;
 
     key ^= zobTable[startSquare][moving];
     key ^= zobTable[endSquare][moving];
@@ -979,6 +1482,18 @@ uint64_t Board::keyAfter(const Move move) const {
     return key;
 }
 
+// starts loading the network weights a move is going to need, so that they're in the cache by the time its child is evaluated
+// king moves are left out, since they can change the input bucket and need a refresh anyway
+void Board::prefetchFeatures(const Move move) const {
+    const int startSquare = move.getStartSquare();
+    const int endSquare = move.getEndSquare();
+    const int moving = pieceAtIndex(startSquare);
+    if(getType(moving) == King) return;
+
+    const BoardState &state = currentState();
+    nnueState.prefetchMove(moving, startSquare, endSquare, pieceAtIndex(endSquare), state.kingSquares[0], state.kingSquares[1]);
+}
+
 int Board::getPlyCount() const {
     return plyCount;
 }
@@ -991,10 +1506,10 @@ bool Board::isPKEndgame() const {
 
 int Board::getPawnHashIndex() const {
 	// last 15 bits
-    return stateHistory.back().pawnHash & Corrhist::mask;
+    return currentState().pawnHash & Corrhist::mask;
 }
 
-uint64_t Board::calculateThreats() {
+uint64_t Board::calculateThreats() const {
     const int them = 1 - colorToMove;
     const uint64_t occupied = getOccupiedBitboard();
 
@@ -1025,21 +1540,26 @@ uint64_t Board::calculateThreats() {
         threats |= ((pawns >> 9) & ~getFileMask(7)) | ((pawns >> 7) & ~getFileMask(0));
     else threats |= ((pawns << 7) & ~getFileMask(7)) | ((pawns << 9) & ~getFileMask(0));
 
-    threats |= getKingAttacks(stateHistory.back().kingSquares[them]);
+    threats |= getKingAttacks(currentState().kingSquares[them]);
 
     return threats;
 }
 
 uint64_t Board::getThreats() const {
-    return stateHistory.back().threats;
+    const BoardState &state = currentState();
+    if(!state.threatsValid) {
+        state.threats = calculateThreats();
+        state.threatsValid = true;
+    }
+    return state.threats;
 }
 
 int Board::getMajorHash() const {
-    return stateHistory.back().majorHash & Corrhist::mask;
+    return currentState().majorHash & Corrhist::mask;
 }
 
 int Board::getMinorHash() const {
-    return stateHistory.back().minorHash & Corrhist::mask;
+    return currentState().minorHash & Corrhist::mask;
 }
 
 bool Board::isPseudolegal(Move move) const {
@@ -1073,7 +1593,7 @@ bool Board::isPseudolegal(Move move) const {
 
         // movegen checks
         // Check if any castling rights exist for the current player
-        if((stateHistory.back().castlingRights & kingRightMasks[1 - colorToMove]) == 0) {
+        if((currentState().castlingRights & kingRightMasks[1 - colorToMove]) == 0) {
             return false;
         }
 
@@ -1081,23 +1601,23 @@ bool Board::isPseudolegal(Move move) const {
         // Check specific castling move types
         if(colorToMove == 1) { // White to move
             if(from == 4 && to == 6 && flag == castling[0]) { // White kingside castling
-                return (stateHistory.back().castlingRights & 1) != 0 &&
+                return (currentState().castlingRights & 1) != 0 &&
                        (occ & 0x60) == 0 &&
                        !squareIsUnderAttack(5);
             }
             else if(from == 4 && to == 2 && flag == castling[1]) { // White queenside castling
-                return (stateHistory.back().castlingRights & 2) != 0 &&
+                return (currentState().castlingRights & 2) != 0 &&
                        (occ & 0xE) == 0 &&
                        !squareIsUnderAttack(3);
             }
         } else { // Black to move
             if(from == 60 && to == 62 && flag == castling[2]) { // Black kingside castling
-                return (stateHistory.back().castlingRights & 4) != 0 &&
+                return (currentState().castlingRights & 4) != 0 &&
                        (occ & 0x6000000000000000) == 0 &&
                        !squareIsUnderAttack(61);
             }
             else if(from == 60 && to == 58 && flag == castling[3]) { // Black queenside castling
-                return (stateHistory.back().castlingRights & 8) != 0 &&
+                return (currentState().castlingRights & 8) != 0 &&
                        (occ & 0xE00000000000000) == 0 &&
                        !squareIsUnderAttack(59);
             }
@@ -1107,7 +1627,7 @@ bool Board::isPseudolegal(Move move) const {
 
     if(getType(piece) == Pawn) {
         if(flag == EnPassant) {
-            return to == stateHistory.back().enPassantIndex && (getPawnAttacks(from, colorToMove) & (1ULL << to)) != 0;
+            return to == currentState().enPassantIndex && (getPawnAttacks(from, colorToMove) & (1ULL << to)) != 0;
         }
 
         const auto fromRank = from / 8;
@@ -1197,7 +1717,7 @@ bool Board::isPseudolegal(Move move) const {
 int Board::getNoisies(std::array<Move, 256> &moves, int totalMoves) const {
     uint64_t occupiedBitboard = getOccupiedBitboard();
 
-    uint64_t mask = stateHistory.back().coloredBitboards[colorToMove] ^ getColoredPieceBitboard(colorToMove, Pawn);
+    uint64_t mask = currentState().coloredBitboards[colorToMove] ^ getColoredPieceBitboard(colorToMove, Pawn);
     while (mask != 0) {
         uint8_t startSquare = popLSB(mask);
         uint8_t currentType = getType(pieceAtIndex(startSquare));
@@ -1208,7 +1728,7 @@ int Board::getNoisies(std::array<Move, 256> &moves, int totalMoves) const {
         else if (currentType == Queen)  total = getRookAttacks(startSquare, occupiedBitboard) | getBishopAttacks(startSquare, occupiedBitboard);
         else if (currentType == King)   total = getKingAttacks(startSquare);
 
-        total &= stateHistory.back().coloredBitboards[1 - colorToMove];
+        total &= currentState().coloredBitboards[1 - colorToMove];
         while (total != 0) {
             moves[totalMoves] = Move(startSquare, popLSB(total), Normal);
             totalMoves++;
@@ -1216,9 +1736,9 @@ int Board::getNoisies(std::array<Move, 256> &moves, int totalMoves) const {
     }
 
     uint64_t pawnBitboard = getColoredPieceBitboard(colorToMove, Pawn);
-    uint64_t capturable = stateHistory.back().coloredBitboards[1 - colorToMove];
-    if (stateHistory.back().enPassantIndex != 64)
-        capturable |= squareToBitboard[stateHistory.back().enPassantIndex];
+    uint64_t capturable = currentState().coloredBitboards[1 - colorToMove];
+    if (currentState().enPassantIndex != 64)
+        capturable |= squareToBitboard[currentState().enPassantIndex];
 
     uint64_t leftCaptures = (colorToMove == 0 ? pawnBitboard >> 9 : pawnBitboard << 7);
     leftCaptures &= ~getFileMask(7);
@@ -1235,13 +1755,13 @@ int Board::getNoisies(std::array<Move, 256> &moves, int totalMoves) const {
     while (leftCaptures != 0) {
         int index = popLSB(leftCaptures);
         int startSquare = index + (colorToMove == 0 ? 9 : -7);
-        moves[totalMoves] = Move(startSquare, index, (index == stateHistory.back().enPassantIndex ? EnPassant : Normal));
+        moves[totalMoves] = Move(startSquare, index, (index == currentState().enPassantIndex ? EnPassant : Normal));
         totalMoves++;
     }
     while (rightCaptures != 0) {
         int index = popLSB(rightCaptures);
         int startSquare = index + (colorToMove == 0 ? 7 : -9);
-        moves[totalMoves] = Move(startSquare, index, (index == stateHistory.back().enPassantIndex ? EnPassant : Normal));
+        moves[totalMoves] = Move(startSquare, index, (index == currentState().enPassantIndex ? EnPassant : Normal));
         totalMoves++;
     }
     while (leftCapturePromotions != 0) {
@@ -1267,23 +1787,23 @@ int Board::getNoisies(std::array<Move, 256> &moves, int totalMoves) const {
 int Board::getQuiets(std::array<Move, 256> &moves, int totalMoves) const {
     uint64_t occupiedBitboard = getOccupiedBitboard();
 
-    if ((stateHistory.back().castlingRights & kingRightMasks[1 - colorToMove]) != 0) {
+    if ((currentState().castlingRights & kingRightMasks[1 - colorToMove]) != 0) {
         if (!isInCheck()) {
             if (colorToMove == 1) {
-                if ((stateHistory.back().castlingRights & 1) != 0 && (occupiedBitboard & 0x60) == 0 && !squareIsUnderAttack(5)) {
+                if ((currentState().castlingRights & 1) != 0 && (occupiedBitboard & 0x60) == 0 && !squareIsUnderAttack(5)) {
                     moves[totalMoves] = Move(4, 6, castling[0]);
                     totalMoves++;
                 }
-                if ((stateHistory.back().castlingRights & 2) != 0 && (occupiedBitboard & 0xE) == 0 && !squareIsUnderAttack(3)) {
+                if ((currentState().castlingRights & 2) != 0 && (occupiedBitboard & 0xE) == 0 && !squareIsUnderAttack(3)) {
                     moves[totalMoves] = Move(4, 2, castling[1]);
                     totalMoves++;
                 }
             } else {
-                if ((stateHistory.back().castlingRights & 4) != 0 && (occupiedBitboard & 0x6000000000000000) == 0 && !squareIsUnderAttack(61)) {
+                if ((currentState().castlingRights & 4) != 0 && (occupiedBitboard & 0x6000000000000000) == 0 && !squareIsUnderAttack(61)) {
                     moves[totalMoves] = Move(60, 62, castling[2]);
                     totalMoves++;
                 }
-                if ((stateHistory.back().castlingRights & 8) != 0 && (occupiedBitboard & 0xE00000000000000) == 0 && !squareIsUnderAttack(59)) {
+                if ((currentState().castlingRights & 8) != 0 && (occupiedBitboard & 0xE00000000000000) == 0 && !squareIsUnderAttack(59)) {
                     moves[totalMoves] = Move(60, 58, castling[3]);
                     totalMoves++;
                 }
@@ -1291,7 +1811,7 @@ int Board::getQuiets(std::array<Move, 256> &moves, int totalMoves) const {
         }
     }
 
-    uint64_t mask = stateHistory.back().coloredBitboards[colorToMove] ^ getColoredPieceBitboard(colorToMove, Pawn);
+    uint64_t mask = currentState().coloredBitboards[colorToMove] ^ getColoredPieceBitboard(colorToMove, Pawn);
     while (mask != 0) {
         uint8_t startSquare = popLSB(mask);
         uint8_t currentType = getType(pieceAtIndex(startSquare));
@@ -122,19 +122,8 @@ double runGame(Engine &engine, std::vector<std::string>& fenVector, Board board)
             std::mt19937_64 gen(rd());
 
             // get moves
-            std::array<Move, 256> PLmoves;
-            const int totalMoves = board.getMoves(PLmoves);
-
             std::array<Move, 256> moves;
-            int legalMoves = 0;
-            // legality check
-            for(int j = 0; j < totalMoves; j++) {
-                if(board.makeMove<true>(PLmoves[j])) {
-                    moves[legalMoves] = PLmoves[j];
-                    legalMoves++;
-                    board.undoMove<true>();
-                }
-            }
+            const int legalMoves = board.getLegalMoves(moves);
             // checkmate or stalemate? doesn't matter, restart
             if(legalMoves == 0) {
                 return 2;
@@ -151,19 +140,8 @@ double runGame(Engine &engine, std::vector<std::string>& fenVector, Board board)
             if(board.getFiftyMoveCount() >= 50) return 0.5;
             // checkmate check
             // get moves
-            std::array<Move, 256> PLmoves;
-            const int totalMoves = board.getMoves(PLmoves);
-
             std::array<Move, 256> moves;
-            int legalMoves = 0;
-            // legality check
-            for(int j = 0; j < totalMoves; j++) {
-                if(board.makeMove<true>(PLmoves[j])) {
-                    moves[legalMoves] = PLmoves[j];
-                    legalMoves++;
-                    board.undoMove<true>();
-                }
-            }
+            const int legalMoves = board.getLegalMoves(moves);
             // checkmate or stalemate?
             if(legalMoves == 0) {
                 int colorMultiplier = 2 * board.getColorToMove() - 1;
@@ -17,7 +17,15 @@
 */
 #include "globals.h"
 #include "immintrin.h"
-#include "simd.h"
+#include "kernels.h"
+#include <cpuid.h>
+#include <filesystem>
+#include "largepages.h"
+#include "bench.h"
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
 
 #ifdef _MSC_VER
 #define SP_MSVC
@@ -36,6 +44,189 @@
 namespace {
     INCBIN(network, NetworkFile);
     const Network *network = reinterpret_cast<const Network *>(g_networkData);
+    // the output weights in the order the forward kernels read them, the network itself is left the way the trainer wrote it
+    // the trainer has [bucket][side][neuron], this is [bucket][block of kernelBlockSize neurons][side][neuron in block]
+    // so that forward goes through them in one stream, a cache line for each side at a time
+    alignas(64) std::array<int16_t, layer1Size * 2 * outputBucketCount> kernelOutputWeights;
+    void layoutNetwork() {
+        for(int bucket = 0; bucket < outputBucketCount; bucket++) {
+            const int16_t *from = network->outputWeights.data() + bucket * 2 * layer1Size;
+            int16_t *to = kernelOutputWeights.data() + bucket * 2 * layer1Size;
+            for(int side = 0; side < 2; side++) {
+                for(int i = 0; i < layer1Size; i++) {
+                    to[2 * (i / kernelBlockSize) * kernelBlockSize + side * kernelBlockSize + i % kernelBlockSize] = from[side * layer1Size + i];
+                }
+            }
+        }
+    }
+    // the feature weights squeezed into int8s, when every one of them fits, which halves what the accumulator updates pull through the cache
+    // the sums are still done in int16, so the accumulators come out exactly the same either way
+    LargeArray<int8_t> compactFeatureWeights;
+    bool useCompactWeights = false;
+    void compactNetwork() {
+        const auto &weights = network->featureWeights;
+        const bool fits = std::ranges::all_of(weights, [](int16_t weight) {
+            return weight >= INT8_MIN && weight <= INT8_MAX;
+        });
+        if(!fits) {
+            compactFeatureWeights = LargeArray<int8_t>();
+            useCompactWeights = false;
+            return;
+        }
+        if(compactFeatureWeights.size() != weights.size()) {
+            compactFeatureWeights.allocate(weights.size());
+        }
+        std::ranges::transform(weights, compactFeatureWeights.data(), [](int16_t weight) {
+            return int8_t(weight);
+        });
+        useCompactWeights = true;
+    }
+    // how much of the start of a row gets prefetched, the hardware prefetcher picks up the rest once the row is being read in order
+    constexpr int prefetchBytes = 256;
+    void prefetchFeature(int index) {
+        const char *row = useCompactWeights ? reinterpret_cast<const char *>(compactFeatureWeights.data() + index * layer1Size)
+                                            : reinterpret_cast<const char *>(network->featureWeights.data() + index * layer1Size);
+        for(int offset = 0; offset < prefetchBytes; offset += 64) {
+            __builtin_prefetch(row + offset);
+        }
+    }
+    // adds or takes away one feature's row of weights, from whichever copy of them is being used
+    template <bool Add>
+    void applyFeature(int16_t *__restrict__ acc, int index) {
+        // copying this from the search rewrite, reportedly this was to fix my speed when compiling on windows?
+        // I don't know but i should probably bring it back anyway.
+        const auto apply = [&](const auto *__restrict__ row) {
+            for(int i = 0; i < layer1Size; ++i) {
+                if constexpr(Add) {
+                    acc[i] += row[i];
+                } else {
+                    acc[i] -= row[i];
+                }
+            }
+        };
+        if(useCompactWeights) {
+            apply(compactFeatureWeights.data() + index * layer1Size);
+        } else {
+            apply(network->featureWeights.data() + index * layer1Size);
+        }
+    }
+    // the embedded network gets copied onto huge pages, since the feature weights are read all over the place for every update
+    // other globals (like the board in uci.cpp) can use the network before this runs, which is fine since it's the same data
+    LargeArray<Network> copyNetwork() {
+        LargeArray<Network> copy(1);
+        std::memcpy(copy.data(), g_networkData, networkBytes);
+        network = copy.data();
+        layoutNetwork();
+        compactNetwork();
+        return copy;
+    }
+    LargeArray<Network> networkStorage = copyNetwork();
+    // the network from EvalFile, mapped read only so that every engine on the machine using it shares one copy in the page cache
+    LargeArray<Network> networkFile;
+    std::string networkPath;
+    // worked out the first time something asks for it, and again after the network changes
+    uint64_t cachedNetworkHash = 0;
+    // whether forward skips the vectors of activations that are all zero, which depends on both the network and the kernels
+    bool useSparseForward = false;
+    void chooseForward();
+}
+
+const SimdKernels *kernels = &kernelsBaseline;
+
+// every set of kernels this cpu can run, worst to best
+std::vector<const SimdKernels *> supportedKernels() {
+    __builtin_cpu_init();
+    std::vector<const SimdKernels *> result = {&kernelsBaseline};
+    if(__builtin_cpu_supports("avx2")) {
+        result.push_back(&kernelsAVX2);
+        // avx-vnni (the 256 bit one that cpus without avx512 have) is leaf 7 subleaf 1, eax bit 4, which the builtins don't all know about
+        unsigned int eax, ebx, ecx, edx;
+        if(__get_cpuid_count(7, 1, &eax, &ebx, &ecx, &edx) && (eax & (1 << 4)) != 0) {
+            result.push_back(&kernelsAVXVNNI);
+        }
+    }
+    if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+        result.push_back(&kernelsAVX512);
+        if(__builtin_cpu_supports("avx512vnni")) {
+            result.push_back(&kernelsAVX512VNNI);
+        }
+    }
+    return result;
+}
+
+void selectKernels() {
+    kernels = supportedKernels().back();
+    chooseForward();
+}
+
+std::string_view networkBacking() {
+    return backingName(networkFile.size() != 0 ? networkFile.backing() : networkStorage.backing());
+}
+
+// fnv-1a over every byte of the network
+uint64_t networkHash() {
+    if(cachedNetworkHash == 0) {
+        const auto *bytes = reinterpret_cast<const uint8_t *>(network);
+        uint64_t result = 0xcbf29ce484222325ULL;
+        for(size_t i = 0; i < networkBytes; i++) {
+            result = (result ^ bytes[i]) * 0x100000001b3ULL;
+        }
+        cachedNetworkHash = result;
+    }
+    return cachedNetworkHash;
+}
+
+std::string_view networkName() {
+    return networkPath.empty() ? std::string_view("<embedded>") : std::string_view(networkPath);
+}
+
+bool compactWeightsInUse() {
+    return useCompactWeights;
+}
+
+bool setCompactWeights(bool enabled) {
+    useCompactWeights = enabled && compactFeatureWeights.size() != 0;
+    return useCompactWeights;
+}
+
+bool loadNetwork(const std::string &path) {
+    if(path.empty() || path == "<empty>" || path == "<embedded>") {
+        networkFile = LargeArray<Network>();
+        networkPath.clear();
+        network = networkStorage.data();
+        layoutNetwork();
+        compactNetwork();
+        chooseForward();
+        cachedNetworkHash = 0;
+        return true;
+    }
+    std::error_code error;
+    const size_t fileSize = std::filesystem::file_size(path, error);
+    if(error) {
+        std::cout << "couldn't open " << path << '\n';
+        return false;
+    }
+    // some trainers pad the end of the file out to 64 bytes
+    if(fileSize < networkBytes || fileSize >= networkBytes + 64) {
+        std::cout << path << " is " << fileSize << " bytes, but this network is " << networkBytes << '\n';
+        return false;
+    }
+    LargeAllocation mapped = mapFile(path, 0, fileSize, false);
+    if(mapped.ptr == nullptr) {
+        std::cout << "failed to map " << path << '\n';
+        return false;
+    }
+    // the old mapping is only let go of once the new one is in place
+    LargeArray<Network> newFile;
+    newFile.adopt(mapped, 1);
+    network = newFile.data();
+    layoutNetwork();
+    compactNetwork();
+    chooseForward();
+    networkFile = std::move(newFile);
+    networkPath = path;
+    cachedNetworkHash = 0;
+    return true;
 }
 
 void NetworkState::reset() {
@@ -44,9 +235,390 @@ void NetworkState::reset() {
     refreshTable.init();
 
     stack[current].initialize(network->featureBiases);
+    lazy[current] = LazyAccumulatorState();
+    lazy[current].computed = {true, true};
+    lazy[current].nullMove = false;
+}
+
+// the level whose accumulator this level actually uses, skipping past null moves
+int NetworkState::resolve(int level) const {
+    while(lazy[level].nullMove) level--;
+    return level;
+}
+
+// brings one half of the accumulator at this level up to date from the one at source
+void NetworkState::applyUpdates(int level, int source, int color) {
+    const LazyAccumulatorState &state = lazy[level];
+    const NetworkUpdates &updates = state.updates;
+    const int king = state.kings[color];
+    const int16_t *__restrict__ prev = color == 0 ? stack[source].black.data() : stack[source].white.data();
+    int16_t *__restrict__ acc = color == 0 ? stack[level].black.data() : stack[level].white.data();
+
+    // the same either way, other than which type the weights are and which kernels go with them
+    const auto update = [&](const auto *__restrict__ weights, auto addSub, auto addSubSub, auto addAddSubSub) {
+        using Weight = std::remove_cvref_t<decltype(*weights)>;
+        std::array<const Weight *, 2> adds;
+        std::array<const Weight *, 2> subs;
+        for(int j = 0; j < updates.numAdds; j++) {
+            adds[j] = weights + getFeatureIndex(updates.adds[j].square, updates.adds[j].piece, color, king) * layer1Size;
+        }
+        for(int j = 0; j < updates.numSubs; j++) {
+            subs[j] = weights + getFeatureIndex(updates.subs[j].square, updates.subs[j].piece, color, king) * layer1Size;
+        }
+
+        if(updates.numAdds == 1 && updates.numSubs == 1) {
+            addSub(acc, prev, adds[0], subs[0]);
+        } else if(updates.numAdds == 1 && updates.numSubs == 2) {
+            addSubSub(acc, prev, adds[0], subs[0], subs[1]);
+        } else if(updates.numAdds == 2 && updates.numSubs == 2) {
+            addAddSubSub(acc, prev, adds[0], adds[1], subs[0], subs[1]);
+        } else {
+            // shouldn't happen with legal moves, but just in case
+            std::memcpy(acc, prev, layer1Size * sizeof(int16_t));
+            for(int j = 0; j < updates.numAdds; j++) {
+                for(int i = 0; i < layer1Size; ++i) {
+                    acc[i] += adds[j][i];
+                }
+            }
+            for(int j = 0; j < updates.numSubs; j++) {
+                for(int i = 0; i < layer1Size; ++i) {
+                    acc[i] -= subs[j][i];
+                }
+            }
+        }
+    };
+    if(useCompactWeights) {
+        update(compactFeatureWeights.data(), kernels->addSub8, kernels->addSubSub8, kernels->addAddSubSub8);
+    } else {
+        update(network->featureWeights.data(), kernels->addSub, kernels->addSubSub, kernels->addAddSubSub);
+    }
+}
+
+// times each kind of fused update against doing a pass over the accumulator per feature, like it used to
+void runUpdateBench() {
+    constexpr int iterations = 2000000;
+    constexpr int rowCount = 4096;
+    // static so that the stores can't be optimized away
+    static std::array<Accumulator, 2> accumulators;
+    accumulators[0].initialize(network->featureBiases);
+    accumulators[1].initialize(network->featureBiases);
+
+    std::mt19937 rng(0);
+    std::vector<const int16_t *> rows(rowCount);
+    for(auto &row : rows) {
+        row = network->featureWeights.data() + (rng() % (inputSize * inputBucketCount)) * layer1Size;
+    }
+
+    const auto time = [&](auto update) {
+        const auto begin = std::chrono::steady_clock::now();
+        for(int i = 0; i < iterations; i++) {
+            int16_t *out = accumulators[(i + 1) & 1].black.data();
+            const int16_t *in = accumulators[i & 1].black.data();
+            update(out, in, &rows[(i * 4) % rowCount]);
+        }
+        const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+        return double(elapsed) / iterations;
+    };
+    const auto separate = [](int16_t *__restrict__ out, const int16_t *__restrict__ in, const int16_t *const *features, int adds, int subs) {
+        for(int i = 0; i < layer1Size; ++i) {
+            out[i] = in[i] + features[0][i];
+        }
+        for(int j = 1; j < adds; j++) {
+            for(int i = 0; i < layer1Size; ++i) {
+                out[i] += features[j][i];
+            }
+        }
+        for(int j = adds; j < adds + subs; j++) {
+            for(int i = 0; i < layer1Size; ++i) {
+                out[i] -= features[j][i];
+            }
+        }
+    };
+
+    std::cout << "accumulator update cost per half (ns), " << kernels->name << ", fused vs one pass per feature\n";
+    const double quietFused = time([](int16_t *out, const int16_t *in, const int16_t *const *f) {
+        kernels->addSub(out, in, f[0], f[1]);
+    });
+    const double quietSeparate = time([&](int16_t *out, const int16_t *in, const int16_t *const *f) {
+        separate(out, in, f, 1, 1);
+    });
+    std::cout << "quiet (add1/sub1): " << quietFused << " vs " << quietSeparate << '\n';
+    const double captureFused = time([](int16_t *out, const int16_t *in, const int16_t *const *f) {
+        kernels->addSubSub(out, in, f[0], f[1], f[2]);
+    });
+    const double captureSeparate = time([&](int16_t *out, const int16_t *in, const int16_t *const *f) {
+        separate(out, in, f, 1, 2);
+    });
+    std::cout << "capture (add1/sub2): " << captureFused << " vs " << captureSeparate << '\n';
+    const double castleFused = time([](int16_t *out, const int16_t *in, const int16_t *const *f) {
+        kernels->addAddSubSub(out, in, f[0], f[1], f[2], f[3]);
+    });
+    const double castleSeparate = time([&](int16_t *out, const int16_t *in, const int16_t *const *f) {
+        separate(out, in, f, 2, 2);
+    });
+    std::cout << "castling (add2/sub2): " << castleFused << " vs " << castleSeparate << '\n';
+}
+
+// walks each bench position with king moves whenever there are any, evaluating after every one, so the finny table refresh is most of the work
+// the same seed every time, so the walks are the same between builds
+void runRefreshBench() {
+    constexpr int walksPerPosition = 2000;
+    constexpr int walkLength = 16;
+    std::mt19937 rng(0);
+    uint64_t kingMoves = 0;
+    uint64_t bucketChanges = 0;
+    uint64_t totalMoves = 0;
+    volatile int sink = 0;
+
+    const auto begin = std::chrono::steady_clock::now();
+    for(const auto &fen : benchFens) {
+        Board board(fen);
+        for(int walk = 0; walk < walksPerPosition; walk++) {
+            int made = 0;
+            for(; made < walkLength; made++) {
+                std::array<Move, 256> moves;
+                const int count = board.getQuiets(moves, board.getNoisies(moves, 0));
+                // king moves go at the front, and get tried first
+                int kingCount = 0;
+                for(int i = 0; i < count; i++) {
+                    if(getType(board.pieceAtIndex(moves[i].getStartSquare())) == King) {
+                        std::swap(moves[i], moves[kingCount++]);
+                    }
+                }
+                // the moves are only pseudolegal, so the ones that turn out not to be get swapped out until one works
+                int remaining = count;
+                bool moved = false;
+                while(remaining > 0 && !moved) {
+                    const bool king = kingCount > 0;
+                    const int index = king ? rng() % kingCount : kingCount + rng() % (remaining - kingCount);
+                    const Move move = moves[index];
+                    const bool bucketChange = king && refreshRequired(board.getColorToMove(), move.getStartSquare(), move.getEndSquare());
+                    moved = board.makeMove<true>(move);
+                    if(moved) {
+                        kingMoves += king;
+                        bucketChanges += bucketChange;
+                    } else if(king) {
+                        std::swap(moves[index], moves[--kingCount]);
+                        std::swap(moves[kingCount], moves[--remaining]);
+                    } else {
+                        std::swap(moves[index], moves[--remaining]);
+                    }
+                }
+                if(!moved) break;
+                sink = sink + board.getEvaluation();
+            }
+            totalMoves += made;
+            for(int i = 0; i < made; i++) {
+                board.undoMove<true>();
+            }
+        }
+    }
+    const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+    std::cout << totalMoves << " moves, " << kingMoves << " by kings, " << bucketChanges << " of them into another input bucket\n";
+    std::cout << double(elapsed) / totalMoves << " ns per move and evaluation\n";
+}
+
+// how many evaluations a second the output layer can do on the bench positions with each set of kernels this cpu can run
+// the accumulators are already up to date so this is almost all forward()
+void runEvalBench() {
+    constexpr int iterations = 200000;
+    std::vector<Board> boards;
+    for(const auto &fen : benchFens) {
+        boards.emplace_back(fen);
+    }
+    const SimdKernels *selected = kernels;
+    for(const SimdKernels *candidate : supportedKernels()) {
+        kernels = candidate;
+        chooseForward();
+        // volatile so the evaluations can't be thrown away
+        volatile int sink = 0;
+        const auto begin = std::chrono::steady_clock::now();
+        for(int i = 0; i < iterations; i++) {
+            sink = sink + boards[i % boards.size()].getEvaluation();
+        }
+        const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+        std::cout << (candidate == &kernelsBaseline ? "baseline " : "") << candidate->name << (useSparseForward ? " (sparse)" : "") << ": " << int64_t(iterations / (double(elapsed) / 1e9)) << " evals/s, " << double(elapsed) / iterations << " ns per eval\n";
+    }
+    kernels = selected;
+    chooseForward();
+}
+
+// checks the evaluation of every bench position with each set of kernels, using the re-laid-out output weights,
+// against one built from scratch that goes through the weights the way the trainer wrote them
+void runLayoutCheck() {
+    const SimdKernels *selected = kernels;
+    for(const SimdKernels *candidate : supportedKernels()) {
+        kernels = candidate;
+        // the sparse forward has to give the same answers too, even if it isn't being used
+        for(const bool sparse : {false, true}) {
+            useSparseForward = sparse;
+            int mismatches = 0;
+            for(const auto &fen : benchFens) {
+                Board board(fen);
+                const auto [kernel, reference] = board.checkEvaluation();
+                if(kernel != reference) {
+                    if(mismatches == 0) std::cout << "first mismatch: " << fen << " kernel " << kernel << " reference " << reference << '\n';
+                    mismatches++;
+                }
+            }
+            std::cout << (candidate == &kernelsBaseline ? "baseline " : "") << candidate->name << (sparse ? " sparse" : " dense") << ": " << benchFens.size() << " positions, " << mismatches << " mismatches\n";
+        }
+    }
+    kernels = selected;
+    chooseForward();
+}
+
+// a block of lines from the file, and the output scoring it gave back
+struct EvalBatchChunk {
+    std::vector<std::string> lines;
+    std::string output;
+    uint64_t skipped = 0;
+};
+
+// reading, scoring and writing all happen at once: this thread reads the file a chunk of lines at a time,
+// one pool of threads scores the chunks as they come in, and a writer puts them back in file order as they finish
+// everything on a line after a ; or a | is dropped, and lines that aren't a fen are skipped
+void evalBatchFile(const std::string &inPath, const std::string &outPath, int threads) {
+    std::ifstream in(inPath);
+    if(!in) {
+        std::cout << "couldn't open " << inPath << '\n';
+        return;
+    }
+    std::ofstream out(outPath);
+    if(!out) {
+        std::cout << "couldn't open " << outPath << '\n';
+        return;
+    }
+    constexpr size_t chunkLines = 4096;
+    threads = std::max(threads, 1);
+    // how far the reader can get ahead of the writer, so memory stays the same however big the file is
+    const size_t maxInFlight = 4 * size_t(threads);
+
+    std::mutex mutex;
+    std::condition_variable workReady;
+    std::condition_variable chunkDone;
+    std::condition_variable spaceFree;
+    std::deque<std::pair<uint64_t, std::unique_ptr<EvalBatchChunk>>> work;
+    std::map<uint64_t, std::unique_ptr<EvalBatchChunk>> done;
+    size_t inFlight = 0;
+    bool finishedReading = false;
+    // only the writer touches these until it's joined
+    uint64_t total = 0;
+    uint64_t skipped = 0;
+    const auto begin = std::chrono::steady_clock::now();
+
+    std::vector<std::jthread> workers;
+    for(int t = 0; t < threads; t++) {
+        workers.emplace_back([&] {
+            std::vector<BoardState> states;
+            std::vector<uint8_t> colors;
+            std::vector<size_t> kept;
+            std::vector<int> scores;
+            while(true) {
+                std::unique_lock lock(mutex);
+                workReady.wait(lock, [&] { return !work.empty() || finishedReading; });
+                if(work.empty()) return;
+                auto [sequence, chunk] = std::move(work.front());
+                work.pop_front();
+                lock.unlock();
+
+                states.clear();
+                colors.clear();
+                kept.clear();
+                for(size_t i = 0; i < chunk->lines.size(); i++) {
+                    BoardState state;
+                    uint8_t color;
+                    if(evaluationStateFromFen(chunk->lines[i], state, color)) {
+                        states.push_back(state);
+                        colors.push_back(color);
+                        kept.push_back(i);
+                    }
+                }
+                scores.resize(states.size());
+                NetworkState::evaluateBatch(states, colors, scores);
+                for(size_t i = 0; i < states.size(); i++) {
+                    chunk->output += chunk->lines[kept[i]] + " | " + std::to_string(scaleEvaluation(scores[i], states[i])) + '\n';
+                }
+                chunk->skipped = chunk->lines.size() - states.size();
+
+                lock.lock();
+                done.emplace(sequence, std::move(chunk));
+                chunkDone.notify_one();
+            }
+        });
+    }
+
+    std::jthread writer([&] {
+        uint64_t next = 0;
+        while(true) {
+            std::unique_lock lock(mutex);
+            chunkDone.wait(lock, [&] { return done.contains(next) || (finishedReading && inFlight == 0); });
+            if(!done.contains(next)) return;
+            std::unique_ptr<EvalBatchChunk> chunk = std::move(done.extract(next).mapped());
+            lock.unlock();
+            out << chunk->output;
+            total += chunk->lines.size();
+            skipped += chunk->skipped;
+            lock.lock();
+            inFlight--;
+            next++;
+            spaceFree.notify_one();
+        }
+    });
+
+    uint64_t sequence = 0;
+    while(true) {
+        auto chunk = std::make_unique<EvalBatchChunk>();
+        std::string line;
+        while(chunk->lines.size() < chunkLines && std::getline(in, line)) {
+            line = line.substr(0, line.find_first_of(";|"));
+            while(!line.empty() && std::isspace(static_cast<unsigned char>(line.back()))) line.pop_back();
+            chunk->lines.push_back(std::move(line));
+        }
+        if(chunk->lines.empty()) break;
+        std::unique_lock lock(mutex);
+        spaceFree.wait(lock, [&] { return inFlight < maxInFlight; });
+        inFlight++;
+        work.emplace_back(sequence++, std::move(chunk));
+        workReady.notify_one();
+    }
+    {
+        std::lock_guard lock(mutex);
+        finishedReading = true;
+    }
+    workReady.notify_all();
+    chunkDone.notify_all();
+    workers.clear();
+    writer.join();
+
+    const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin).count();
+    std::cout << (total - skipped) << " positions scored, " << skipped << " skipped, " << int64_t((total - skipped) / (std::max<int64_t>(elapsed, 1) / 1000.0)) << " positions/s\n";
+}
+
+// walks back to the last level with this half done, then applies everything since then on the way up
+void NetworkState::materialize(int color) {
+    int base = current;
+    while(lazy[base].nullMove || !lazy[base].computed[color]) base--;
+    for(int level = base + 1; level <= current; level++) {
+        if(lazy[level].nullMove || lazy[level].computed[color]) continue;
+        applyUpdates(level, resolve(level - 1), color);
+        lazy[level].computed[color] = true;
+    }
+}
+
+// makes the current level hold its own up to date accumulator, for things that change it in place
+void NetworkState::materializeCurrent() {
+    materialize(0);
+    materialize(1);
+    if(lazy[current].nullMove) {
+        stack[current] = stack[resolve(current)];
+        lazy[current].nullMove = false;
+        lazy[current].computed = {true, true};
+    }
 }
 
 void NetworkState::performUpdates(NetworkUpdates updates, int blackKing, int whiteKing, const BoardState &state) {
+    materializeCurrent();
     assert(updates.numAdds <= 2);
     assert(updates.numSubs <= 2);
     if(updates.bucketChange) {
@@ -67,30 +639,18 @@ void NetworkState::performUpdates(NetworkUpdates updates, int blackKing, int whi
     }
 }
 void NetworkState::performUpdatesAndPush(NetworkUpdates updates, int blackKing, int whiteKing, const BoardState &state) {
-    assert(updates.numAdds <= 2);
+    assert(updates.numAdds >= 1 && updates.numAdds <= 2);
     assert(updates.numSubs <= 2);
+    current++;
+    lazy[current].updates = updates;
+    lazy[current].kings = {blackKing, whiteKing};
+    lazy[current].computed = {false, false};
+    lazy[current].nullMove = false;
     if(updates.bucketChange) {
-        if(updates.bucketUpdate.piece == 0) {
-            stack[current + 1].white = stack[current].white; 
-        } else {
-            stack[current + 1].black = stack[current].black;
-        }
-        current++;
-        for(int i = 0; i < updates.numAdds; i++) {
-            activateFeatureSingle(updates.adds[i].square, updates.adds[i].piece, 1 - updates.bucketUpdate.piece, updates.bucketUpdate.piece == 1 ? blackKing : whiteKing);
-        }
-        for(int i = 0; i < updates.numSubs; i++) {
-            disableFeatureSingle(updates.subs[i].square, updates.subs[i].piece, 1 - updates.bucketUpdate.piece, updates.bucketUpdate.piece == 1 ? blackKing : whiteKing);
-        }
-        refreshAccumulator(updates.bucketUpdate.piece /*being used here to store color*/, state, updates.bucketUpdate.piece == 0 ? blackKing : whiteKing);
-    } else {
-        activateFeatureAndPush(updates.adds[0].square, updates.adds[0].piece, blackKing, whiteKing);
-        for(int i = 1; i < updates.numAdds; i++) {
-            activateFeature(updates.adds[i].square, updates.adds[i].piece, blackKing, whiteKing);
-        }
-        for(int i = 0; i < updates.numSubs; i++) {
-            disableFeature(updates.subs[i].square, updates.subs[i].piece, blackKing, whiteKing);
-        }
+        // the side whose king changed buckets gets refreshed from the finny table, which needs the board as it is right now, so that half can't wait
+        const int color = updates.bucketUpdate.piece;
+        refreshAccumulator(color, state, color == 0 ? blackKing : whiteKing);
+        lazy[current].computed[color] = true;
     }
 }
 
@@ -112,60 +672,30 @@ int getIBucket(int color, int king) {
 void NetworkState::refreshAccumulator(int color, const BoardState &state, int king) {
     const int bucket = getIBucket(color, king);
 
-    RefreshTableEntry &entry = refreshTable.table[bucket];
-    BoardState &prevBoards = entry.colorBoards(color);
+    RefreshTableEntry &entry = refreshTable.entry(color, bucket);
+    int16_t *acc = entry.accumulator.data();
 
     for(int piece = 0; piece < None; ++piece) {
         for(int c = 0; c < 2; c++) {
-            const uint64_t prev = prevBoards.pieceBitboards[piece] & prevBoards.coloredBitboards[c];
+            const uint64_t prev = entry.pieces[c][piece];
             const uint64_t curr = state.pieceBitboards[piece] & state.coloredBitboards[c];
+            entry.pieces[c][piece] = curr;
 
             uint64_t added = curr & ~prev;
             uint64_t removed = prev & ~curr;
-            //std::cout << "added:  " << added << std::endl;
-            //std::cout << "removed: " << removed << std::endl;
 
             while(added) {
                 const int sq = popLSB(added);
-                const int index = getFeatureIndex(sq, c * 8 + piece, color, king);
-                
-                // copying this from the search rewrite, reportedly this was to fix my speed when compiling on windows?
-                // I don't know but i should probably bring it back anyway.
-                const int16_t *__restrict__ weights = network->featureWeights.data();
-                int16_t *__restrict__ acc =
-                    (color == 0 ? entry.accumulator.black.data()
-                                : entry.accumulator.white.data());
-
-                const int16_t *__restrict__ w = weights + index * layer1Size;
-
-                for (int i = 0; i < layer1Size; ++i) {
-                    acc[i] += w[i];
-                }
+                applyFeature<true>(acc, getFeatureIndex(sq, c * 8 + piece, color, king));
             }
 
             while(removed) {
                 const int sq = popLSB(removed);
-                const int index = getFeatureIndex(sq, c * 8 + piece, color, king);
-
-                const int16_t *__restrict__ weights = network->featureWeights.data();
-                int16_t *__restrict__ acc =
-                    (color == 0 ? entry.accumulator.black.data()
-                                : entry.accumulator.white.data());
-
-                const int16_t *__restrict__ w = weights + index * layer1Size;
-
-                for (int i = 0; i < layer1Size; ++i) {
-                    acc[i] -= w[i];
-                }
+                applyFeature<false>(acc, getFeatureIndex(sq, c * 8 + piece, color, king));
             }
         }
     }
-    if(color == 0) {
-        std::memcpy(&stack[current].black, &entry.accumulator.black, sizeof(std::array<int16_t, layer1Size>));
-    } else {
-        std::memcpy(&stack[current].white, &entry.accumulator.white, sizeof(std::array<int16_t, layer1Size>));
-    }
-    std::memcpy(&prevBoards, &state, sizeof(BoardState));
+    std::memcpy(color == 0 ? stack[current].black.data() : stack[current].white.data(), acc, sizeof(entry.accumulator));
 }
 
 void NetworkState::fullRefresh(const BoardState &state, int blackKing, int whiteKing) {
@@ -174,6 +704,7 @@ void NetworkState::fullRefresh(const BoardState &state, int blackKing, int white
 }
 
 void NetworkState::halfRefresh(int color, const BoardState &state, int king) {
+    materializeCurrent();
     stack[current].initHalf(network->featureBiases, color);
 
     for(int c = 0; c < 2; c++) {
@@ -191,10 +722,10 @@ void NetworkState::halfRefresh(int color, const BoardState &state, int king) {
 
 void RefreshTable::init() {
     table.clear();
-    table.resize(inputBucketCount * 2);
-    for(int i = 0; i < inputBucketCount * 2; i++) {
-        table[i].accumulator.initialize(network->featureBiases);
-        std::memset(table[i].boards.data(), 0, sizeof(BoardState) * 2);
+    table.resize(2 * inputBucketCount * 2);
+    for(auto &entry : table) {
+        std::ranges::copy(network->featureBiases, entry.accumulator.begin());
+        entry.pieces = {};
     }
 }
 
@@ -204,6 +735,7 @@ constexpr int Scale = 400;
 constexpr int Qa = 256;
 constexpr int Qb = 64;
 constexpr int Qab = Qa * Qb;
+static_assert(Qa == kernelQa && layer1Size == kernelLayerSize);
 
 
 std::pair<uint32_t, uint32_t> NetworkState::getFeatureIndices(int square, int piece, int blackKing, int whiteKing) {
@@ -228,97 +760,234 @@ int getBucket(int pieceCount) {
     return (pieceCount - 2) / divisor;
 }
 
-/*
-    A technique that I am using here was invented yesterday (as of writing this) by SomeLizard, developer of the engine Lizard
-    I am using the SCReLU activation function, which is CReLU(x)^2 * W
-    the technique is to use CReLU(x) * w * CReLU(x) which allows you (assuming weight is in (-127, 127))
-    to fit the resulting number in a 16 bit integer, allowing you to perform the remaining functions
-    on twice as many numbers at once, leading to a pretty sizeable speedup
-*/
-
 int NetworkState::forward(const int bucket, const std::span<int16_t, layer1Size> us, const std::span<int16_t, layer1Size> them, const std::span<const int16_t, layer1Size * 2 * outputBucketCount> weights) {
-    const int bucketIncrement = 2 * layer1Size * bucket;
-    const Vector zero   = simd_zero();
-    const Vector maxVal = simd_set1_epi16(Qa);
- 
-    Vector sum = simd_zero();
- 
-    for (int i = 0; i < layer1Size / weightsPerVector; ++i)
-    {
-        // us
-        Vector u = simd_load(reinterpret_cast<const Vector *>(&us[i * weightsPerVector]));
-        u = simd_max_epi16(simd_min_epi16(u, maxVal), zero);
-        Vector uw = simd_load(reinterpret_cast<const Vector *>(&weights[i * weightsPerVector + bucketIncrement]));
-        sum = simd_add_epi32(sum, simd_madd_epi16(u, simd_mullo_epi16(u, uw)));
- 
-        // them
-        Vector t = simd_load(reinterpret_cast<const Vector *>(&them[i * weightsPerVector]));
-        t = simd_max_epi16(simd_min_epi16(t, maxVal), zero);
-        Vector tw = simd_load(reinterpret_cast<const Vector *>(&weights[layer1Size + i * weightsPerVector + bucketIncrement]));
-        sum = simd_add_epi32(sum, simd_madd_epi16(t, simd_mullo_epi16(t, tw)));
-    }
- 
-    return simd_reduce_add_epi32(sum);
+    const int16_t *bucketWeights = weights.data() + 2 * layer1Size * bucket;
+    return useSparseForward ? kernels->forwardSparse(us.data(), them.data(), bucketWeights) : kernels->forward(us.data(), them.data(), bucketWeights);
+}
+
+void NetworkState::prefetchMove(int piece, int start, int end, int captured, int blackKing, int whiteKing) const {
+    const std::array<int, 2> kings = {blackKing, whiteKing};
+    for(int color = 0; color < 2; color++) {
+        prefetchFeature(getFeatureIndex(end, piece, color, kings[color]));
+        prefetchFeature(getFeatureIndex(start, piece, color, kings[color]));
+        if(captured != None) {
+            prefetchFeature(getFeatureIndex(end, captured, color, kings[color]));
+        }
+    }
 }
 
 void NetworkState::activateFeature(int square, int piece, int blackKing, int whiteKing){ 
+    materializeCurrent();
     activateFeatureSingle(square, piece, 0, blackKing);
     activateFeatureSingle(square, piece, 1, whiteKing);
 }
 
 void NetworkState::activateFeatureSingle(int square, int piece, int color, int king){ 
     const int index = getFeatureIndex(square, piece, color, king);
+    int16_t *acc = color == 0 ? stack[current].black.data() : stack[current].white.data();
+    applyFeature<true>(acc, index);
+}
 
-    const int16_t *__restrict__ weights = network->featureWeights.data();
-    int16_t *__restrict__ acc =
-        (color == 0 ? stack[current].black.data()
-                    : stack[current].white.data());
+void NetworkState::disableFeature(int square, int piece, int blackKing, int whiteKing) {
+    materializeCurrent();
+    disableFeatureSingle(square, piece, 0, blackKing);
+    disableFeatureSingle(square, piece, 1, whiteKing);
+}
 
-    for (int i = 0; i < layer1Size; ++i) {
-        acc[i] += weights[index * layer1Size + i];
+void NetworkState::disableFeatureSingle(int square, int piece, int color, int king) {
+    const int index = getFeatureIndex(square, piece, color, king);
+    int16_t *acc = color == 0 ? stack[current].black.data() : stack[current].white.data();
+    applyFeature<false>(acc, index);
+}
+
+int NetworkState::evaluate(int colorToMove, int materialCount) {
+    materialize(0);
+    materialize(1);
+    Accumulator &acc = stack[resolve(current)];
+    const int bucket = getBucket(materialCount);
+    const auto output = colorToMove == 0 ? forward(bucket, acc.black, acc.white, kernelOutputWeights) : forward(bucket, acc.white, acc.black, kernelOutputWeights);
+    return (output / Qa + network->outputBiases[bucket]) * Scale / Qab;
+}
+
+void EvalCache::resize(size_t newSizeMB) {
+    // rounded down to a power of two so the index is just a mask
+    const size_t entries = newSizeMB * 1024 * 1024 / sizeof(Entry);
+    table.assign(entries == 0 ? 0 : std::bit_floor(entries), Entry());
+    mask = table.empty() ? 0 : table.size() - 1;
+    probes = 0;
+    hits = 0;
+}
+
+void EvalCache::clear() {
+    std::fill(table.begin(), table.end(), Entry());
+    probes = 0;
+    hits = 0;
+}
+
+void NetworkState::buildAccumulator(const BoardState &state, Accumulator &acc) {
+    const auto build = [&](const auto *weights, auto accumulate) {
+        for(int color = 0; color < 2; color++) {
+            std::array<decltype(weights), 32> rows;
+            int rowCount = 0;
+            for(int c = 0; c < 2; c++) {
+                for(int piece = 0; piece < 6; piece++) {
+                    uint64_t bitboard = state.pieceBitboards[piece] & state.coloredBitboards[c];
+                    while(bitboard != 0) {
+                        // evaluationStateFromFen turns away anything with more than 32 pieces
+                        assert(rowCount < 32);
+                        rows[rowCount++] = weights + getFeatureIndex(popLSB(bitboard), 8 * c + piece, color, state.kingSquares[color]) * layer1Size;
+                    }
+                }
+            }
+            int16_t *half = color == 0 ? acc.black.data() : acc.white.data();
+            accumulate(half, network->featureBiases.data(), rows.data(), rowCount);
+        }
+    };
+    if(useCompactWeights) {
+        build(compactFeatureWeights.data(), kernels->accumulate8);
+    } else {
+        build(network->featureWeights.data(), kernels->accumulate);
     }
 }
 
-void NetworkState::activateFeatureAndPush(int square, int piece, int blackKing, int whiteKing){ 
-    const auto [blackIdx, whiteIdx] = getFeatureIndices(square, piece, blackKing, whiteKing);
+// builds accumulators from scratch a chunk at a time, and then runs the output layer over each chunk a bucket at a time
+void NetworkState::evaluateBatch(std::span<const BoardState> states, std::span<const uint8_t> colorsToMove, std::span<int> scores) {
+    constexpr size_t chunkSize = 64;
+    thread_local std::vector<Accumulator> accumulators(chunkSize);
 
-    const int16_t *__restrict__ weights = network->featureWeights.data();
+    for(size_t start = 0; start < states.size(); start += chunkSize) {
+        const size_t count = std::min(chunkSize, states.size() - start);
+        for(size_t p = 0; p < count; p++) {
+            buildAccumulator(states[start + p], accumulators[p]);
+        }
 
-    const int16_t *__restrict__ blackPrev = stack[current].black.data();
-    const int16_t *__restrict__ whitePrev = stack[current].white.data();
+        for(int bucket = 0; bucket < outputBucketCount; bucket++) {
+            std::array<const int16_t *, chunkSize> us;
+            std::array<const int16_t *, chunkSize> them;
+            std::array<size_t, chunkSize> indices;
+            int bucketCount = 0;
+            for(size_t p = 0; p < count; p++) {
+                const BoardState &state = states[start + p];
+                if(getBucket(__builtin_popcountll(state.coloredBitboards[0] | state.coloredBitboards[1])) != bucket) continue;
+                const bool black = colorsToMove[start + p] == 0;
+                us[bucketCount] = black ? accumulators[p].black.data() : accumulators[p].white.data();
+                them[bucketCount] = black ? accumulators[p].white.data() : accumulators[p].black.data();
+                indices[bucketCount++] = start + p;
+            }
+            if(bucketCount == 0) continue;
+            std::array<int, chunkSize> outputs;
+            kernels->forwardBatch(us.data(), them.data(), kernelOutputWeights.data() + bucket * 2 * layer1Size, bucketCount, outputs.data());
+            for(int i = 0; i < bucketCount; i++) {
+                scores[indices[i]] = (outputs[i] / Qa + network->outputBiases[bucket]) * Scale / Qab;
+            }
+        }
+    }
+}
 
-    int16_t *__restrict__ blackNext = stack[current + 1].black.data();
-    int16_t *__restrict__ whiteNext = stack[current + 1].white.data();
+namespace {
+    // the bench positions, with their accumulators built from scratch, as a sample of what the output layer sees
+    struct ForwardSample {
+        std::vector<Accumulator> accumulators;
+        std::vector<uint8_t> colors;
+        std::vector<int> buckets;
+    };
+
+    ForwardSample sampleBenchPositions() {
+        ForwardSample sample;
+        sample.accumulators.reserve(benchFens.size());
+        for(const auto &fen : benchFens) {
+            BoardState state;
+            uint8_t color;
+            if(!evaluationStateFromFen(fen, state, color)) continue;
+            NetworkState::buildAccumulator(state, sample.accumulators.emplace_back());
+            sample.colors.push_back(color);
+            sample.buckets.push_back(getBucket(__builtin_popcountll(state.coloredBitboards[0] | state.coloredBitboards[1])));
+        }
+        return sample;
+    }
 
-    for (int i = 0; i < layer1Size; ++i) {
-        blackNext[i] = blackPrev[i] + weights[blackIdx * layer1Size + i];
-        whiteNext[i] = whitePrev[i] + weights[whiteIdx * layer1Size + i];
+    // the fastest of a few runs over the sample, in ns per evaluation
+    double timeForward(const ForwardSample &sample, int (*forwardKernel)(const int16_t *, const int16_t *, const int16_t *)) {
+        constexpr int trials = 5;
+        constexpr int passes = 20;
+        volatile int sink = 0;
+        double best = 1e9;
+        for(int trial = 0; trial < trials; trial++) {
+            const auto begin = std::chrono::steady_clock::now();
+            for(int pass = 0; pass < passes; pass++) {
+                for(size_t i = 0; i < sample.accumulators.size(); i++) {
+                    const Accumulator &acc = sample.accumulators[i];
+                    const int16_t *weights = kernelOutputWeights.data() + 2 * layer1Size * sample.buckets[i];
+                    sink = sink + (sample.colors[i] == 0 ? forwardKernel(acc.black.data(), acc.white.data(), weights) : forwardKernel(acc.white.data(), acc.black.data(), weights));
+                }
+            }
+            const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+            best = std::min(best, double(elapsed) / (passes * sample.accumulators.size()));
+        }
+        return best;
     }
 
-    current++;
+    // the sparse forward only pays off when enough whole vectors are zero, and where that point is depends on the cpu,
+    // so both are timed on the bench positions, and the sparse one has to be clearly faster to be used
+    void chooseForward() {
+        const ForwardSample sample = sampleBenchPositions();
+        useSparseForward = timeForward(sample, kernels->forwardSparse) < 0.95 * timeForward(sample, kernels->forward);
+    }
 }
 
-void NetworkState::disableFeature(int square, int piece, int blackKing, int whiteKing) {
-    disableFeatureSingle(square, piece, 0, blackKing);
-    disableFeatureSingle(square, piece, 1, whiteKing);
+// how dense the activations going into the output layer are on the bench positions, and which forward that led to
+void printActivationDensity() {
+    const ForwardSample sample = sampleBenchPositions();
+    const double activations = 2.0 * layer1Size * sample.accumulators.size();
+    std::cout << "network: " << networkName() << '\n';
+    const SimdKernels *selected = kernels;
+    for(const SimdKernels *candidate : supportedKernels()) {
+        uint64_t nonZero = 0;
+        uint64_t zeroVectors = 0;
+        for(const Accumulator &acc : sample.accumulators) {
+            candidate->countActivations(acc.black.data(), acc.white.data(), nonZero, zeroVectors);
+        }
+        if(candidate == &kernelsBaseline) {
+            std::cout << "activation density: " << 100.0 * nonZero / activations << "%\n";
+        }
+        std::cout << (candidate == &kernelsBaseline ? "baseline " : "") << candidate->name << ": " << 100.0 * zeroVectors * candidate->width / activations << "% of "
+                  << candidate->width << " wide vectors all zero, forward " << timeForward(sample, candidate->forward) << "ns dense vs " << timeForward(sample, candidate->forwardSparse) << "ns sparse\n";
+    }
+    std::cout << "using the " << (useSparseForward ? "sparse" : "dense") << " forward with " << selected->name << '\n';
 }
 
-void NetworkState::disableFeatureSingle(int square, int piece, int color, int king) {
-    const int index = getFeatureIndex(square, piece, color, king);
-
-    const int16_t *__restrict__ weights = network->featureWeights.data();
-    int16_t *__restrict__ acc =
-        (color == 0 ? stack[current].black.data()
-                    : stack[current].white.data());
-
-    for (int i = 0; i < layer1Size; ++i) {
-        acc[i] -= weights[index * layer1Size + i];
+// the output layer without simd, straight from the weights as the trainer laid them out, to check the kernels and the layout against
+// the multiply is truncated to 16 bits just like the kernels do it
+int referenceForward(const int bucket, const std::span<const int16_t, layer1Size> us, const std::span<const int16_t, layer1Size> them) {
+    const int16_t *weights = network->outputWeights.data() + bucket * 2 * layer1Size;
+    int sum = 0;
+    for(int i = 0; i < layer1Size; i++) {
+        const int u = std::clamp<int>(us[i], 0, Qa);
+        const int t = std::clamp<int>(them[i], 0, Qa);
+        sum += u * int16_t(u * weights[i]);
+        sum += t * int16_t(t * weights[layer1Size + i]);
     }
+    return sum;
 }
 
-// todo: lazy updates (oh no)
-int NetworkState::evaluate(int colorToMove, int materialCount) {
+int NetworkState::evaluateFromScratch(const BoardState &state, int colorToMove, int materialCount) {
+    Accumulator acc;
+    acc.initialize(network->featureBiases);
+    for(int color = 0; color < 2; color++) {
+        int16_t *accHalf = color == 0 ? acc.black.data() : acc.white.data();
+        for(int c = 0; c < 2; c++) {
+            for(int piece = 0; piece < 6; piece++) {
+                uint64_t bitboard = state.pieceBitboards[piece] & state.coloredBitboards[c];
+                while(bitboard != 0) {
+                    const int index = getFeatureIndex(popLSB(bitboard), 8 * c + piece, color, state.kingSquares[color]);
+                    for(int i = 0; i < layer1Size; ++i) {
+                        accHalf[i] += network->featureWeights[index * layer1Size + i];
+                    }
+                }
+            }
+        }
+    }
     const int bucket = getBucket(materialCount);
-    const auto output = colorToMove == 0 ? forward(bucket, stack[current].black, stack[current].white, network->outputWeights) : forward(bucket, stack[current].white, stack[current].black, network->outputWeights);
+    const auto output = colorToMove == 0 ? referenceForward(bucket, acc.black, acc.white) : referenceForward(bucket, acc.white, acc.black);
     return (output / Qa + network->outputBiases[bucket]) * Scale / Qab;
 }
\ No newline at end of file
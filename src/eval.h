@@ -18,6 +18,7 @@
 #pragma once
 
 #include "globals.h"
+#include <cstddef>
 
 /*
 Current Net: cn_028
@@ -61,11 +62,8 @@ constexpr std::array<int, 64> inputBuckets = []{
 }();
 
 // organizing this somewhat similarly to code I've seen, mostly from clarity_sp_nnue, made by Ciekce.
-#if defined(__AVX512F__) && defined(__AVX512BW__)
+// always 64, since the avx512 kernels can be picked at runtime even when the rest of the engine wasn't built with avx512
 constexpr int alignmentAmount = 64;
-#else 
-constexpr int alignmentAmount = 32;
-#endif
 
 struct alignas(alignmentAmount) Network {
     std::array<std::int16_t, inputSize * inputBucketCount * layer1Size> featureWeights;
@@ -73,6 +71,33 @@ struct alignas(alignmentAmount) Network {
     std::array<std::int16_t, layer1Size * 2 * outputBucketCount> outputWeights;
     std::array<std::int16_t, outputBucketCount> outputBiases;
 };
+// the size of a network file, which is a bit less than sizeof(Network) since that gets padded out to the alignment
+constexpr size_t networkBytes = offsetof(Network, outputBiases) + sizeof(Network::outputBiases);
+
+// which kind of pages the network ended up on
+std::string_view networkBacking();
+// a hash of the network's weights, so things saved with one network aren't used with another
+uint64_t networkHash();
+// switches to the network in a file, or back to the embedded one for an empty path, only between searches
+// anything already evaluated with the old network (accumulators, the tt) has to be thrown away by the caller
+bool loadNetwork(const std::string &path);
+std::string_view networkName();
+// whether the feature weights are being read from the int8 copy, which only exists when every one of them fits in an int8
+bool compactWeightsInUse();
+// turns the int8 copy on or off, for benchmarking, and gives back whether it's in use afterwards
+bool setCompactWeights(bool enabled);
+// microbenchmark for the accumulator update kernels
+void runUpdateBench();
+// moves the kings around as much as possible, which is what makes the accumulators get refreshed from the finny table
+void runRefreshBench();
+// throughput of the output layer with each set of simd kernels the cpu supports
+void runEvalBench();
+// checks that the re-laid-out network evaluates the bench positions exactly like the one the trainer wrote does
+void runLayoutCheck();
+// shows how many of the output layer's inputs are zero on the bench positions, and whether that made the sparse forward worth using
+void printActivationDensity();
+// scores every fen in a file with the network, spread over some threads, and writes them out with their scores
+void evalBatchFile(const std::string &inPath, const std::string &outPath, int threads);
 
 struct Accumulator {
     alignas(alignmentAmount) std::array<std::int16_t, layer1Size> black;
@@ -81,32 +106,47 @@ struct Accumulator {
     void initHalf(std::span<const std::int16_t, layer1Size> bias, int color);
 };
 
+// one side's accumulator for one input bucket, and the pieces it was last brought up to date with
+// only the piece bitboards are kept, since they're all the refresh looks at
 struct RefreshTableEntry {
-    Accumulator accumulator;
-    std::array<BoardState, 2> boards{};
-
-    BoardState &colorBoards(int c) {
-        return boards[c];
-    }
+    alignas(alignmentAmount) std::array<std::int16_t, layer1Size> accumulator;
+    // [color][piece]
+    std::array<std::array<uint64_t, 6>, 2> pieces;
 };
 
 struct RefreshTable {
+    // [perspective][input bucket], so each side's entries sit next to each other
     std::vector<RefreshTableEntry> table;
 
     void init();
+    RefreshTableEntry &entry(int color, int bucket) {
+        return table[color * inputBucketCount * 2 + bucket];
+    }
+};
+
+// what a level of the accumulator stack needs to be brought up to date later on
+struct LazyAccumulatorState {
+    NetworkUpdates updates;
+    std::array<int, 2> kings;
+    std::array<bool, 2> computed;
+    // null moves don't change anything, so they just use whatever is below them
+    bool nullMove;
 };
 
 class NetworkState {
     public:
         NetworkState() {
             stack.resize(128);
+            lazy.resize(128);
             reset();
         }
+        // for null moves
         inline void push() {
-            stack[current + 1] = stack[current];
             current++;
+            lazy[current].nullMove = true;
         }
         void performUpdates(NetworkUpdates updates, int blackKing, int whiteKing, const BoardState &state);
+        // the updates only get applied once something is evaluated, since a lot of nodes get cut before that
         void performUpdatesAndPush(NetworkUpdates updates, int blackKing, int whiteKing, const BoardState &state);
         inline void pop() {
             current--;
@@ -114,22 +154,70 @@ class NetworkState {
         void reset();
         void activateFeature(int square, int type, int blackKing, int whiteKing);
         void activateFeatureSingle(int square, int type, int color, int king);
-        void activateFeatureAndPush(int square, int type, int blackKing, int whiteKing);
         void disableFeature(int square, int type, int blackKing, int whiteKing);
         void disableFeatureSingle(int square, int type, int color, int king);
         void refreshAccumulator(int color, const BoardState &state, int king);
+        // prefetches the rows of feature weights that a move of this piece will add and take away, for both sides
+        // promotions and en passant are close enough, since it's only a hint
+        void prefetchMove(int piece, int start, int end, int captured, int blackKing, int whiteKing) const;
         int evaluate(int colorToMove, int materialCount);
+        // evaluates with an accumulator built from nothing, to check the incremental one against
+        int evaluateFromScratch(const BoardState &state, int colorToMove, int materialCount);
+        // what evaluate would say for each of these positions, without needing a Board or a NetworkState for them
+        static void evaluateBatch(std::span<const BoardState> states, std::span<const uint8_t> colorsToMove, std::span<int> scores);
+        static void buildAccumulator(const BoardState &state, Accumulator &acc);
         void fullRefresh(const BoardState &state, int blackKing, int whiteKing);
         void halfRefresh(int color, const BoardState &state, int king);
     private:
         RefreshTable refreshTable;
         int current;
         std::vector<Accumulator> stack;
+        std::vector<LazyAccumulatorState> lazy;
+        int resolve(int level) const;
+        void materialize(int color);
+        void materializeCurrent();
+        void applyUpdates(int level, int source, int color);
         static std::pair<uint32_t, uint32_t> getFeatureIndices(int square, int type, int blackKing, int whiteKing);
         static int getFeatureIndex(int square, int type, int color, int king);
         int forward(const int bucket, const std::span<std::int16_t, layer1Size> us, const std::span<std::int16_t, layer1Size> them, const std::span<const std::int16_t, layer1Size * 2 * outputBucketCount> weights);
 };
 
+// raw network outputs by zobrist key, one per search thread, so a position the tt has already lost doesn't need the whole forward pass again
+// direct mapped with the top half of the key to check against, collisions are just as rare as in the tt
+class EvalCache {
+    public:
+        EvalCache() {
+            resize(defaultSizeMB);
+        }
+        // 0 turns it off
+        void resize(size_t newSizeMB);
+        // also forgets the hit counters
+        void clear();
+        inline bool probe(uint64_t key, int &eval) {
+            if(table.empty()) return false;
+            probes++;
+            const Entry &entry = table[key & mask];
+            if(entry.key != uint32_t(key >> 32)) return false;
+            hits++;
+            eval = entry.eval;
+            return true;
+        }
+        inline void store(uint64_t key, int eval) {
+            if(table.empty()) return;
+            table[key & mask] = {uint32_t(key >> 32), int32_t(eval)};
+        }
+        static constexpr size_t defaultSizeMB = 1;
+        uint64_t probes = 0;
+        uint64_t hits = 0;
+    private:
+        struct Entry {
+            uint32_t key;
+            int32_t eval;
+        };
+        std::vector<Entry> table;
+        uint64_t mask = 0;
+};
+
 constexpr bool refreshRequired(int color, int oldKingSquare, int newKingSquare) {
     if(color == 0) {
         oldKingSquare ^= 56;
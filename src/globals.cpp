@@ -18,6 +18,7 @@
 #include "tunables.h"
 #include "globals.h"
 #include "slidey.h"
+#include "kernels.h"
 
 // takes a piece number and gets the type of it
 int getType(int value) {
@@ -86,24 +87,15 @@ void calculateReductions() {
     }
 }
 
-std::array<uint64_t, 64> squareToBitboard;
-
-void generateSquareToBitboard() {
-    for(int i = 0; i < 64; i++) {
-        squareToBitboard[i] = (1ULL << i);
-    }
-}
-
-/*ran on startup, does 4 things:
-1: generates the lookups for sliding pieces
-2: generates the numbers used for zobrist hashing
-3: calculates the numbers for LMR
-4: calculates numbers for square to bitboard lookups
+/*ran on startup, does 3 things:
+1: picks the simd kernels for the network, based on what the cpu supports
+2: picks pext or magics for the sliding pieces, the tables for both are already in the binary
+3: calculates the numbers for LMR, which can't be done ahead of time since they depend on tunables
+the zobrist keys and square to bitboard lookups are made by the compiler
  */
 void initialize() {
-    generateSquareToBitboard();
+    selectKernels();
     generateLookups();
-    initializeZobrist();
     calculateReductions();
 }
 
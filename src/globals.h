@@ -37,6 +37,7 @@
 #include <memory>
 #include <cstring>
 #include <atomic>
+#include <future>
 #include <span>
 
 // nicknaming std::views because funny and also toanth
@@ -69,23 +70,6 @@ extern std::array<std::array<uint8_t, 218>, 150> reductions;
 // structs and stuff
 struct Board;
 
-// holds the state of the board, specifically the factors that can't be brought back after a move is made
-struct BoardState {
-    std::array<uint64_t, 2> coloredBitboards;
-    std::array<uint64_t, 6> pieceBitboards;
-    std::array<uint8_t, 64> mailbox;
-    uint8_t enPassantIndex;
-    std::array<uint8_t, 2> kingSquares;
-    uint8_t hundredPlyCounter;
-    uint8_t castlingRights;
-    uint64_t zobristHash;
-    uint64_t pawnHash;
-    std::array<uint64_t, 2> nonPawnHashes;
-    uint64_t majorHash;
-    uint64_t minorHash;
-    uint64_t threats;
-};
-
 // a single move, stored in 16 bits
 struct Move {
     public:
@@ -104,6 +88,30 @@ struct Move {
         uint16_t value;
 };
 
+// holds the state of the board, specifically the factors that can't be brought back after a move is made
+// one of these gets copied for every move, so anything that can be put back by undoing the move (the mailbox) lives on the Board instead
+struct BoardState {
+    std::array<uint64_t, 2> coloredBitboards;
+    std::array<uint64_t, 6> pieceBitboards;
+    uint64_t zobristHash;
+    uint64_t pawnHash;
+    std::array<uint64_t, 2> nonPawnHashes;
+    uint64_t majorHash;
+    uint64_t minorHash;
+    // the squares the side not to move attacks, which only get worked out the first time something asks for them (see Board::getThreats)
+    mutable uint64_t threats;
+    // the move that led here and what it moved and took, which is what undoing it needs to fix the mailbox
+    // a null move or the starting position has no move
+    Move move;
+    uint8_t movedPiece;
+    uint8_t capturedPiece;
+    std::array<uint8_t, 2> kingSquares;
+    uint8_t enPassantIndex;
+    uint8_t hundredPlyCounter;
+    uint8_t castlingRights;
+    mutable bool threatsValid;
+};
+
 #include "eval.h"
 
 // the board itself
@@ -111,9 +119,12 @@ struct Board {
     public:
         Board(std::string fen);
         Board(BoardState s, int ctm);
-        template <bool PushNNUE> bool makeMove(Move move);
+        // CheckLegality = false skips making sure the king isn't left in check, for moves that already went through getLegalMoves or isLegal
+        template <bool PushNNUE, bool CheckLegality = true> bool makeMove(Move move);
         template <bool PushNNUE> void undoMove();
         int getMoves(std::array<Move, 256> &moves) const;
+        // only the moves that don't leave the king in check, so nothing it gives back needs to be tried first
+        int getLegalMoves(std::array<Move, 256> &moves) const;
         int getMovesQSearch(std::array<Move, 256> &moves) const;
         std::string getFenString();
         bool isInCheck() const;
@@ -128,10 +139,14 @@ struct Board {
         void changeColor();
         void undoChangeColor();
         int getEvaluation();
+        int getEvaluation(EvalCache &cache);
+        // the raw network output from the incremental accumulators and from one built from scratch, they should always match
+        std::pair<int, int> checkEvaluation();
         int getCastlingRights() const;
         int getEnPassantIndex() const;
         uint64_t fullZobristRegen();
         bool isRepeatedPosition();
+        bool hasUpcomingRepetition() const;
         bool isLegalMove(const Move& move);
         uint64_t getAttackers(int square) const;
         uint64_t getColoredBitboard(int color) const;
@@ -143,24 +158,45 @@ struct Board {
         int getMinorHash() const;
         BoardState getBoardState() const;
         uint64_t keyAfter(const Move move) const;
+        void prefetchFeatures(const Move move) const;
         int getPlyCount() const;
         bool isPKEndgame() const;
         int getPawnHashIndex() const;
         uint64_t getThreats() const;
-        uint64_t calculateThreats();
+        uint64_t calculateThreats() const;
         bool isPseudolegal(Move move) const;
+        uint64_t getPinned() const;
+        uint64_t getCheckers() const;
+        bool isLegal(Move move, uint64_t pinned, uint64_t checkers) const;
         int getNoisies(std::array<Move, 256> &moves, int totalMoves) const;
         int getQuiets(std::array<Move, 256> &moves, int totalMoves) const;
     private:
+        bool isAttackedBy(int square, int opponent) const;
         int plyCount;
         uint8_t colorToMove;
+        // a fixed size stack of states, with stateIndex as the top, so making a move is just a copy into the next slot
+        // it only grows if a game gets longer than it, which a search never does
+        static constexpr int initialStates = 1024;
         std::vector<BoardState> stateHistory;
+        int stateIndex;
+        std::array<uint8_t, 64> mailbox;
+        BoardState &currentState() {
+            return stateHistory[stateIndex];
+        }
+        const BoardState &currentState() const {
+            return stateHistory[stateIndex];
+        }
+        void pushState();
         NetworkState nnueState;
         template <bool UpdateNNUE> void addPiece(int square, int type);
         template <bool UpdateNNUE> void removePiece(int square, int type);
         template <bool UpdateNNUE> void movePiece(int square1, int type1, int square2, int type2);
 };
 
+// getEvaluation's adjustments to what the network says
+[[nodiscard]]int scaleEvaluation(int eval, const BoardState &state);
+bool evaluationStateFromFen(std::string_view fen, BoardState &state, uint8_t &colorToMove);
+
 // the eternal functions, can be used everywhere
 [[nodiscard]]int getType(int value);
 [[nodiscard]]int getColor(int value);
@@ -172,12 +208,12 @@ struct Board {
 [[nodiscard]]uint64_t getBishopAttacksOld(int square, uint64_t occupiedBitboard);
 [[nodiscard]]uint64_t getRookAttacks(int square, uint64_t occupiedBitboard);
 [[nodiscard]]uint64_t getBishopAttacks(int square, uint64_t occupiedBitboard);
+[[nodiscard]]uint64_t getBetween(int square1, int square2);
 [[nodiscard]]uint64_t getPawnPushes(uint64_t pawnBitboard, uint64_t emptyBitboard, int colorToMove);
 [[nodiscard]]uint64_t getDoublePawnPushes(uint64_t pawnAttacks, uint64_t emptyBitboard, int colorToMove);
 [[nodiscard]]uint64_t getPawnAttacks(int square, int colorToMove);
 [[nodiscard]]uint64_t getKnightAttacks(int square);
 [[nodiscard]]uint64_t getKingAttacks(int square);
-void initializeZobrist();
 void initialize();
 std::vector<std::string> split(const std::string string, const char seperator);
 void sortMoves(std::array<int, 256> &values, std::array<Move, 256> &moves, int numMoves);
@@ -185,7 +221,13 @@ void incrementalSort(std::array<int, 256> &values, std::array<Move, 256> &moves,
 int flipIndex(int index);
 void calculateReductions();
 uint64_t getPassedPawnMask(int square, int colorToMove);
-extern std::array<uint64_t, 64> squareToBitboard;
+constexpr std::array<uint64_t, 64> squareToBitboard = [] {
+    std::array<uint64_t, 64> bitboards = {};
+    for(int i = 0; i < 64; i++) {
+        bitboards[i] = 1ULL << i;
+    }
+    return bitboards;
+}();
 
 // conthist hehe
 using CHEntry = std::array<std::array<std::array<int16_t, 64>, 7>, 2>;
@@ -19,8 +19,12 @@
 
 #include "globals.h"
 #include "corrhist.h"
+#include "largepages.h"
 
 constexpr int depthLimit = 120;
+constexpr int pawnHistorySize = 32768;
+
+using PawnHistoryEntry = std::array<std::array<std::array<int16_t, 64>, 6>, 2>;
 
 struct StackEntry {
     std::array<Move, depthLimit> pvTable;
@@ -44,11 +48,13 @@ struct SearchInfo {
     std::array<std::array<std::array<std::array<std::array<int16_t, 2>, 64>, 2>, 64>, 2> historyTable;
     std::array<std::array<std::array<std::array<std::array<int16_t, 2>, 7>, 64>, 6>, 2> noisyHistoryTable;
     std::array<std::array<std::array<std::array<int16_t, 7>, 64>, 6>, 2> qsHistoryTable;
-    std::array<std::array<std::array<std::array<int16_t, 64>, 6>, 2>, 32768> pawnHistoryTable;
+    // these two are by far the biggest tables, so they go on huge pages
+    LargeArray<PawnHistoryEntry> pawnHistoryTable;
     Corrhist corrhist;
-    std::unique_ptr<CHTable> conthistTable;
+    LargeArray<CHTable::value_type> conthistTable;
     std::array<std::array<Move, 64>, 64> counterMoves;
     SearchInfo() {
-        conthistTable = std::make_unique<CHTable>();
+        pawnHistoryTable.allocate(pawnHistorySize);
+        conthistTable.allocate(std::tuple_size_v<CHTable>);
     }
 };
\ No newline at end of file
@@ -0,0 +1,224 @@
+/*
+    Clarity
+    Copyright (C) 2026 Joseph Pasfield
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "kernels.h"
+#include <immintrin.h>
+#include <array>
+
+// this file gets built once for each instruction set, with KERNEL_VARIANT saying which one it is
+#ifndef KERNEL_VARIANT
+#define KERNEL_VARIANT Baseline
+#endif
+#define KERNEL_CONCAT(a, b) a##b
+#define KERNEL_NAME(variant) KERNEL_CONCAT(kernels, variant)
+
+// everything but the table at the bottom stays local to this copy, so the linker can't mix up functions built for different instruction sets
+namespace {
+
+#include "simd.h"
+
+// the feature weights can also be kept as int8s (see compactNetwork in eval.cpp), which get sign extended as they're loaded
+inline Vector loadWeights(const int16_t *ptr) {
+    return simd_load(reinterpret_cast<const Vector *>(ptr));
+}
+
+inline Vector loadWeights(const int8_t *ptr) {
+    return simd_load_epi8_epi16(ptr);
+}
+
+/*
+    fused accumulator updates, for the three kinds of move that make up nearly all of them:
+    add1/sub1 (quiet moves and promotions), add1/sub2 (captures), and add2/sub2 (castling)
+    each vector of the accumulator gets every feature applied while it sits in a register, so the child is only written once
+*/
+template <int Adds, int Subs, typename Weight>
+void fusedUpdate(int16_t *__restrict__ out, const int16_t *__restrict__ in, const std::array<const Weight *, Adds> &adds, const std::array<const Weight *, Subs> &subs) {
+    for(int i = 0; i < kernelLayerSize; i += weightsPerVector) {
+        Vector v = simd_load(reinterpret_cast<const Vector *>(&in[i]));
+        for(int j = 0; j < Adds; j++) {
+            v = simd_add_epi16(v, loadWeights(&adds[j][i]));
+        }
+        for(int j = 0; j < Subs; j++) {
+            v = simd_sub_epi16(v, loadWeights(&subs[j][i]));
+        }
+        simd_store(reinterpret_cast<Vector *>(&out[i]), v);
+    }
+}
+
+template <typename Weight>
+void addSub(int16_t *out, const int16_t *in, const Weight *add0, const Weight *sub0) {
+    fusedUpdate<1, 1, Weight>(out, in, {add0}, {sub0});
+}
+
+template <typename Weight>
+void addSubSub(int16_t *out, const int16_t *in, const Weight *add0, const Weight *sub0, const Weight *sub1) {
+    fusedUpdate<1, 2, Weight>(out, in, {add0}, {sub0, sub1});
+}
+
+template <typename Weight>
+void addAddSubSub(int16_t *out, const int16_t *in, const Weight *add0, const Weight *add1, const Weight *sub0, const Weight *sub1) {
+    fusedUpdate<2, 2, Weight>(out, in, {add0, add1}, {sub0, sub1});
+}
+
+/*
+    A technique that I am using here was invented yesterday (as of writing this) by SomeLizard, developer of the engine Lizard
+    I am using the SCReLU activation function, which is CReLU(x)^2 * W
+    the technique is to use CReLU(x) * w * CReLU(x) which allows you (assuming weight is in (-127, 127))
+    to fit the resulting number in a 16 bit integer, allowing you to perform the remaining functions
+    on twice as many numbers at once, leading to a pretty sizeable speedup
+*/
+int forward(const int16_t *us, const int16_t *them, const int16_t *weights) {
+    const Vector zero   = simd_zero();
+    const Vector maxVal = simd_set1_epi16(kernelQa);
+
+    // separate sums for each side, since with vnni each step waits on the one before it, and one chain can't keep the units busy
+    Vector usSum = simd_zero();
+    Vector themSum = simd_zero();
+
+    for(int i = 0; i < kernelLayerSize; i += kernelBlockSize) {
+        const int16_t *blockWeights = &weights[2 * i];
+        for(int j = 0; j < kernelBlockSize; j += weightsPerVector) {
+            // us
+            Vector u = simd_load(reinterpret_cast<const Vector *>(&us[i + j]));
+            u = simd_max_epi16(simd_min_epi16(u, maxVal), zero);
+            Vector uw = simd_load(reinterpret_cast<const Vector *>(&blockWeights[j]));
+            usSum = simd_dpwssd_epi32(usSum, u, simd_mullo_epi16(u, uw));
+
+            // them
+            Vector t = simd_load(reinterpret_cast<const Vector *>(&them[i + j]));
+            t = simd_max_epi16(simd_min_epi16(t, maxVal), zero);
+            Vector tw = simd_load(reinterpret_cast<const Vector *>(&blockWeights[kernelBlockSize + j]));
+            themSum = simd_dpwssd_epi32(themSum, t, simd_mullo_epi16(t, tw));
+        }
+    }
+
+    return simd_reduce_add_epi32(simd_add_epi32(usSum, themSum));
+}
+
+// where the weights for the vector of activations starting at this neuron are, in the interleaved layout
+constexpr int weightOffset(int neuron, int side) {
+    return 2 * (neuron / kernelBlockSize) * kernelBlockSize + side * kernelBlockSize + neuron % kernelBlockSize;
+}
+
+// forward that only does the multiplies for vectors with at least one activation that isn't clamped to zero
+// the first pass finds them without branching, and the second goes through just those
+int forwardSparse(const int16_t *us, const int16_t *them, const int16_t *weights) {
+    constexpr int vectorCount = kernelLayerSize / weightsPerVector;
+    const Vector zero   = simd_zero();
+    const Vector maxVal = simd_set1_epi16(kernelQa);
+    const std::array<const int16_t *, 2> sides = {us, them};
+
+    std::array<uint16_t, 2 * vectorCount> active;
+    int activeCount = 0;
+    for(int side = 0; side < 2; side++) {
+        for(int v = 0; v < vectorCount; v++) {
+            const Vector x = simd_max_epi16(simd_min_epi16(simd_load(reinterpret_cast<const Vector *>(&sides[side][v * weightsPerVector])), maxVal), zero);
+            active[activeCount] = side * vectorCount + v;
+            activeCount += !simd_is_zero(x);
+        }
+    }
+
+    // two sums again, so the vnni chain is split in half
+    Vector sums[2] = {simd_zero(), simd_zero()};
+    for(int i = 0; i < activeCount; i++) {
+        const int side = active[i] / vectorCount;
+        const int neuron = (active[i] % vectorCount) * weightsPerVector;
+        Vector x = simd_load(reinterpret_cast<const Vector *>(&sides[side][neuron]));
+        x = simd_max_epi16(simd_min_epi16(x, maxVal), zero);
+        const Vector w = simd_load(reinterpret_cast<const Vector *>(&weights[weightOffset(neuron, side)]));
+        sums[i & 1] = simd_dpwssd_epi32(sums[i & 1], x, simd_mullo_epi16(x, w));
+    }
+
+    return simd_reduce_add_epi32(simd_add_epi32(sums[0], sums[1]));
+}
+
+// counts how many activations aren't clamped to zero, and how many whole vectors are, for both sides
+void countActivations(const int16_t *us, const int16_t *them, uint64_t &nonZero, uint64_t &zeroVectors) {
+    const Vector zero   = simd_zero();
+    const Vector maxVal = simd_set1_epi16(kernelQa);
+    for(const int16_t *side : {us, them}) {
+        for(int i = 0; i < kernelLayerSize; i += weightsPerVector) {
+            const Vector x = simd_max_epi16(simd_min_epi16(simd_load(reinterpret_cast<const Vector *>(&side[i])), maxVal), zero);
+            zeroVectors += simd_is_zero(x);
+            for(int j = 0; j < weightsPerVector; j++) {
+                nonZero += side[i + j] > 0;
+            }
+        }
+    }
+}
+
+template <typename Weight>
+void accumulate(int16_t *out, const int16_t *bias, const Weight *const *rows, int count) {
+    for(int i = 0; i < kernelLayerSize; i += weightsPerVector) {
+        Vector v = simd_load(reinterpret_cast<const Vector *>(&bias[i]));
+        for(int j = 0; j < count; j++) {
+            v = simd_add_epi16(v, loadWeights(&rows[j][i]));
+        }
+        simd_store(reinterpret_cast<Vector *>(&out[i]), v);
+    }
+}
+
+// forward for four positions at once, so each weight vector gets loaded once for all four of them
+constexpr int batchWidth = 4;
+void forwardBatch(const int16_t *const *us, const int16_t *const *them, const int16_t *weights, int count, int *out) {
+    const Vector zero   = simd_zero();
+    const Vector maxVal = simd_set1_epi16(kernelQa);
+
+    int position = 0;
+    for(; position + batchWidth <= count; position += batchWidth) {
+        Vector usSums[batchWidth];
+        Vector themSums[batchWidth];
+        for(int k = 0; k < batchWidth; k++) {
+            usSums[k] = simd_zero();
+            themSums[k] = simd_zero();
+        }
+
+        for(int i = 0; i < kernelLayerSize; i += kernelBlockSize) {
+            const int16_t *blockWeights = &weights[2 * i];
+            for(int j = 0; j < kernelBlockSize; j += weightsPerVector) {
+                const Vector uw = simd_load(reinterpret_cast<const Vector *>(&blockWeights[j]));
+                const Vector tw = simd_load(reinterpret_cast<const Vector *>(&blockWeights[kernelBlockSize + j]));
+                for(int k = 0; k < batchWidth; k++) {
+                    Vector u = simd_load(reinterpret_cast<const Vector *>(&us[position + k][i + j]));
+                    u = simd_max_epi16(simd_min_epi16(u, maxVal), zero);
+                    usSums[k] = simd_dpwssd_epi32(usSums[k], u, simd_mullo_epi16(u, uw));
+
+                    Vector t = simd_load(reinterpret_cast<const Vector *>(&them[position + k][i + j]));
+                    t = simd_max_epi16(simd_min_epi16(t, maxVal), zero);
+                    themSums[k] = simd_dpwssd_epi32(themSums[k], t, simd_mullo_epi16(t, tw));
+                }
+            }
+        }
+
+        for(int k = 0; k < batchWidth; k++) {
+            out[position + k] = simd_reduce_add_epi32(simd_add_epi32(usSums[k], themSums[k]));
+        }
+    }
+    // whatever doesn't fill a group of four
+    for(; position < count; position++) {
+        out[position] = forward(us[position], them[position], weights);
+    }
+}
+
+}
+
+extern const SimdKernels KERNEL_NAME(KERNEL_VARIANT) = {
+    simdName, weightsPerVector, forward, forwardSparse,
+    addSub<int16_t>, addSubSub<int16_t>, addAddSubSub<int16_t>, accumulate<int16_t>,
+    addSub<int8_t>, addSubSub<int8_t>, addAddSubSub<int8_t>, accumulate<int8_t>,
+    forwardBatch, countActivations
+};
@@ -0,0 +1,74 @@
+/*
+    Clarity
+    Copyright (C) 2026 Joseph Pasfield
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+/*
+    Kernels:
+    the simd parts of the network (the fused accumulator updates and the output layer) are built once for each
+    instruction set, in kernels.cpp, and the best one the cpu supports is picked when the engine starts
+    this header is kept away from the rest of the engine, since the files that include it get built with flags
+    that the cpu running the engine might not have
+*/
+
+// the same as layer1Size and Qa in eval.cpp, which checks that they match
+constexpr int kernelLayerSize = 1024;
+constexpr int16_t kernelQa = 256;
+// the output weights are interleaved in blocks of this many neurons, one block for us then one for them (see layoutNetwork in eval.cpp)
+// 32 is a cache line of int16s, and a whole number of vectors at every width
+constexpr int kernelBlockSize = 32;
+
+struct SimdKernels {
+    std::string_view name;
+    // how many int16s fit in a vector
+    int width;
+    // the output layer, weights points at the start of the output bucket's interleaved weights
+    int (*forward)(const int16_t *us, const int16_t *them, const int16_t *weights);
+    // the same, but skipping vectors where every activation is zero, which is only faster when enough of them are
+    int (*forwardSparse)(const int16_t *us, const int16_t *them, const int16_t *weights);
+    // the fused updates, for quiet moves (add1/sub1), captures (add1/sub2), and castling (add2/sub2)
+    void (*addSub)(int16_t *out, const int16_t *in, const int16_t *add0, const int16_t *sub0);
+    void (*addSubSub)(int16_t *out, const int16_t *in, const int16_t *add0, const int16_t *sub0, const int16_t *sub1);
+    void (*addAddSubSub)(int16_t *out, const int16_t *in, const int16_t *add0, const int16_t *add1, const int16_t *sub0, const int16_t *sub1);
+    // the bias plus every row, for building a half of an accumulator from scratch
+    void (*accumulate)(int16_t *out, const int16_t *bias, const int16_t *const *rows, int count);
+    // the same four, for when the feature weights fit in int8s and are kept that way
+    void (*addSub8)(int16_t *out, const int16_t *in, const int8_t *add0, const int8_t *sub0);
+    void (*addSubSub8)(int16_t *out, const int16_t *in, const int8_t *add0, const int8_t *sub0, const int8_t *sub1);
+    void (*addAddSubSub8)(int16_t *out, const int16_t *in, const int8_t *add0, const int8_t *add1, const int8_t *sub0, const int8_t *sub1);
+    void (*accumulate8)(int16_t *out, const int16_t *bias, const int8_t *const *rows, int count);
+    // the output layer for several positions in the same output bucket, which share each weight load between them
+    void (*forwardBatch)(const int16_t *const *us, const int16_t *const *them, const int16_t *weights, int count, int *out);
+    // adds up how many activations across both sides aren't zero after the clamp, and how many whole vectors are
+    void (*countActivations)(const int16_t *us, const int16_t *them, uint64_t &nonZero, uint64_t &zeroVectors);
+};
+
+// built with whatever flags the rest of the engine was
+extern const SimdKernels kernelsBaseline;
+// built with -mavx2, -mavx2 -mavxvnni, -mavx512f -mavx512bw, and -mavx512f -mavx512bw -mavx512vnni on top of the usual flags,
+// so each one needs exactly those extensions from the cpu
+extern const SimdKernels kernelsAVX2;
+extern const SimdKernels kernelsAVXVNNI;
+extern const SimdKernels kernelsAVX512;
+extern const SimdKernels kernelsAVX512VNNI;
+
+// the kernels the engine is using, which are the baseline ones until selectKernels() runs
+extern const SimdKernels *kernels;
+void selectKernels();
@@ -0,0 +1,134 @@
+/*
+    Clarity
+    Copyright (C) 2026 Joseph Pasfield
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "largepages.h"
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+constexpr size_t hugePageSize = 2 * 1024 * 1024;
+constexpr size_t gigaPageSize = 1024 * 1024 * 1024;
+// the fallback still lines things up to normal pages
+constexpr size_t normalPageSize = 4096;
+
+std::string_view backingName(PageBacking backing) {
+    switch(backing) {
+        case PageBacking::Transparent: return "transparent huge pages (2MB)";
+        case PageBacking::Huge2MB: return "huge pages (2MB)";
+        case PageBacking::Huge1GB: return "huge pages (1GB)";
+        case PageBacking::FileMapped: return "memory mapped file";
+        default: return "normal pages";
+    }
+}
+
+size_t roundUp(size_t bytes, size_t alignment) {
+    return (bytes + alignment - 1) / alignment * alignment;
+}
+
+#if defined(__linux__)
+// explicit huge pages have to be reserved ahead of time (vm.nr_hugepages), so this fails on most machines
+void *tryHugeTLB(size_t bytes, [[maybe_unused]] bool gigaPages) {
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB;
+#ifdef MAP_HUGE_1GB
+    if(gigaPages) flags |= MAP_HUGE_1GB;
+#else
+    if(gigaPages) return nullptr;
+#endif
+    void *ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, flags, -1, 0);
+    return ptr == MAP_FAILED ? nullptr : ptr;
+}
+
+// madvise only does anything if transparent huge pages are set to "always" or "madvise"
+bool transparentHugePagesEnabled() {
+    std::ifstream file("/sys/kernel/mm/transparent_hugepage/enabled");
+    std::string setting;
+    std::getline(file, setting);
+    return setting.find("[never]") == std::string::npos && !setting.empty();
+}
+#endif
+
+LargeAllocation allocateLarge(size_t bytes) {
+    LargeAllocation allocation;
+    if(bytes == 0) return allocation;
+#if defined(__linux__)
+    // only if that doesn't waste more than 2MB pages would, otherwise something like 1025MB would pin 2GB
+    if(bytes >= gigaPageSize && roundUp(bytes, gigaPageSize) - bytes < hugePageSize) {
+        const size_t rounded = roundUp(bytes, gigaPageSize);
+        if(void *ptr = tryHugeTLB(rounded, true)) return {ptr, rounded, PageBacking::Huge1GB};
+    }
+    if(bytes >= hugePageSize) {
+        const size_t rounded = roundUp(bytes, hugePageSize);
+        if(void *ptr = tryHugeTLB(rounded, false)) return {ptr, rounded, PageBacking::Huge2MB};
+        // map a bit extra so the start can be moved up to a 2MB boundary, then give the ends back
+        void *raw = mmap(nullptr, rounded + hugePageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(raw != MAP_FAILED) {
+            const uintptr_t start = reinterpret_cast<uintptr_t>(raw);
+            const uintptr_t aligned = roundUp(start, hugePageSize);
+            if(aligned > start) munmap(raw, aligned - start);
+            const size_t tail = hugePageSize - (aligned - start);
+            if(tail > 0) munmap(reinterpret_cast<void *>(aligned + rounded), tail);
+            void *ptr = reinterpret_cast<void *>(aligned);
+            const bool advised = madvise(ptr, rounded, MADV_HUGEPAGE) == 0 && transparentHugePagesEnabled();
+            return {ptr, rounded, advised ? PageBacking::Transparent : PageBacking::Normal};
+        }
+    }
+    const size_t rounded = roundUp(bytes, normalPageSize);
+    void *ptr = mmap(nullptr, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(ptr == MAP_FAILED) throw std::bad_alloc();
+    return {ptr, rounded, PageBacking::Normal};
+#else
+    const size_t rounded = roundUp(bytes, normalPageSize);
+    void *ptr = ::operator new(rounded, std::align_val_t(normalPageSize));
+    std::memset(ptr, 0, rounded);
+    return {ptr, rounded, PageBacking::Normal};
+#endif
+}
+
+void freeLarge(LargeAllocation &allocation) {
+    if(allocation.ptr == nullptr) return;
+#if defined(__linux__)
+    munmap(allocation.ptr, allocation.bytes);
+#else
+    ::operator delete(allocation.ptr, std::align_val_t(normalPageSize));
+#endif
+    allocation = LargeAllocation();
+}
+
+LargeAllocation mapFile(const std::string &path, size_t offset, size_t bytes, bool writable) {
+    if(bytes == 0) return LargeAllocation();
+#if defined(__linux__)
+    const int file = open(path.c_str(), O_RDONLY);
+    if(file == -1) return LargeAllocation();
+    void *ptr = mmap(nullptr, bytes, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_PRIVATE, file, offset);
+    // the mapping keeps its own reference to the file
+    close(file);
+    if(ptr == MAP_FAILED) return LargeAllocation();
+    return {ptr, bytes, PageBacking::FileMapped};
+#else
+    // no mmap here, so just read the whole thing in
+    std::ifstream file(path, std::ios::binary);
+    if(!file) return LargeAllocation();
+    LargeAllocation allocation = allocateLarge(bytes);
+    file.seekg(offset);
+    file.read(static_cast<char *>(allocation.ptr), bytes);
+    if(!file) freeLarge(allocation);
+    return allocation;
+#endif
+}
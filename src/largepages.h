@@ -0,0 +1,96 @@
+/*
+    Clarity
+    Copyright (C) 2026 Joseph Pasfield
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+
+#include "globals.h"
+#include <utility>
+
+/*
+    Large Pages:
+    The transposition table, the network, and the history tables get hammered with random accesses,
+    so they are put on huge pages when the system allows it, which cuts down on TLB misses
+*/
+
+enum class PageBacking {
+    Normal, Transparent, Huge2MB, Huge1GB, FileMapped
+};
+
+std::string_view backingName(PageBacking backing);
+
+struct LargeAllocation {
+    void *ptr = nullptr;
+    // the size that was actually mapped, which is rounded up to the page size
+    size_t bytes = 0;
+    PageBacking backing = PageBacking::Normal;
+};
+
+// always gives back zeroed memory
+LargeAllocation allocateLarge(size_t bytes);
+void freeLarge(LargeAllocation &allocation);
+// maps part of a file copy-on-write, so it gets paged in as it's used instead of read all at once, and writes never go back to the file
+// a read only mapping shares the page cache with every other process mapping the same file
+LargeAllocation mapFile(const std::string &path, size_t offset, size_t bytes, bool writable = true);
+
+// an array that lives on huge pages if it can, only for types that are fine being zeroed instead of constructed
+template <typename T>
+struct LargeArray {
+    static_assert(std::is_trivially_copyable_v<T>);
+    public:
+        LargeArray() = default;
+        explicit LargeArray(size_t count) {
+            allocate(count);
+        }
+        LargeArray(const LargeArray &) = delete;
+        LargeArray &operator=(const LargeArray &) = delete;
+        LargeArray(LargeArray &&other) noexcept {
+            *this = std::move(other);
+        }
+        LargeArray &operator=(LargeArray &&other) noexcept {
+            if(this != &other) {
+                freeLarge(allocation);
+                allocation = std::exchange(other.allocation, LargeAllocation());
+                count = std::exchange(other.count, 0);
+            }
+            return *this;
+        }
+        ~LargeArray() {
+            freeLarge(allocation);
+        }
+        // throws away the old contents
+        void allocate(size_t newCount) {
+            freeLarge(allocation);
+            allocation = allocateLarge(newCount * sizeof(T));
+            count = newCount;
+        }
+        // takes over memory from somewhere else, like mapFile
+        void adopt(LargeAllocation newAllocation, size_t newCount) {
+            freeLarge(allocation);
+            allocation = newAllocation;
+            count = newCount;
+        }
+        T *data() { return static_cast<T *>(allocation.ptr); }
+        const T *data() const { return static_cast<const T *>(allocation.ptr); }
+        T &operator[](size_t i) { return data()[i]; }
+        const T &operator[](size_t i) const { return data()[i]; }
+        size_t size() const { return count; }
+        size_t bytes() const { return count * sizeof(T); }
+        PageBacking backing() const { return allocation.backing; }
+    private:
+        LargeAllocation allocation;
+        size_t count = 0;
+};
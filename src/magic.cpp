@@ -18,10 +18,6 @@
 #include "slidey.h"
 #include "magic.h"
 
-// the nested arrays used to lookup the attacks
-std::array<std::array<uint64_t, 512>, 64> bishopAttackLookup;
-std::array<std::array<uint64_t, 4096>, 64> rookAttackLookup;
-
 // yoooo thanks ciekce, pdep made in code because some cpus don't support it but it's still quite useful
 [[nodiscard]] constexpr auto pdep(uint64_t v, uint64_t mask)
 {
@@ -37,71 +33,142 @@ std::array<std::array<uint64_t, 4096>, 64> rookAttackLookup;
     return dst;
 }
 
-int getBishopBlockerCombinations(std::array<uint64_t, 512> &blockers, const uint64_t mask) {
-    // calculates the total amount of possible blocker configuration (2^n)
-    int totalPatterns = 1 << __builtin_popcountll(mask);
-    assert(totalPatterns <= 512);
+// pext made in code too, for packing the compressed tables without needing bmi2 to do it
+[[nodiscard]] constexpr auto pext(uint64_t v, uint64_t mask)
+{
+    uint64_t dst{};
 
-    // generates them, using pdep
-    for(int i = 0; i < totalPatterns; i++) {
-        blockers[i] = pdep(i, mask);
+    for(uint64_t bit = 1; mask != 0; bit <<= 1)
+    {
+        if((v & mask & -mask) != 0)
+            dst |= bit;
+        mask &= mask - 1;
     }
 
-    return totalPatterns;
+    return dst;
 }
 
-// seperated so that I can have the assertions be right
-int getRookBlockerCombinations(std::array<uint64_t, 4096> &blockers, const uint64_t mask) {
-    // calculates the total amount of possible blocker configuration (2^n)
-    int totalPatterns = 1 << __builtin_popcountll(mask);
-    assert(totalPatterns <= 4096);
-
-    // generates them, using pdep
-    for(int i = 0; i < totalPatterns; i++) {
-        blockers[i] = pdep(i, mask);
+// builds one piece's table for pext, going through every blocker pattern for each square
+// the carry rippler steps through the subsets of the mask in the same order pdep would give them, which makes a pattern's index just its number
+template <size_t Size>
+constexpr std::array<uint64_t, Size> buildPextTable(const uint64_t (&masks)[64], const std::array<uint32_t, 65> &offsets, const int firstDirection) {
+    std::array<uint64_t, Size> table = {};
+    for(int square = 0; square < 64; square++) {
+        uint64_t blockers = 0;
+        uint32_t index = offsets[square];
+        do {
+            table[index++] = rayAttacks(square, blockers, firstDirection);
+            blockers = (blockers - masks[square]) & masks[square];
+        } while(blockers != 0);
     }
+    return table;
+}
 
-    return totalPatterns;
+// the same attacks moved to where the magics put them, which saves working them all out again
+template <size_t Size>
+constexpr std::array<uint64_t, Size> buildMagicTable(const std::array<uint64_t, Size> &pextTable, const uint64_t (&masks)[64], const std::array<uint32_t, 65> &offsets, const std::array<uint64_t, 64> &magics) {
+    std::array<uint64_t, Size> table = {};
+    for(int square = 0; square < 64; square++) {
+        const int shift = 64 - std::popcount(masks[square]);
+        uint64_t blockers = 0;
+        uint32_t index = offsets[square];
+        do {
+            table[offsets[square] + ((blockers * magics[square]) >> shift)] = pextTable[index++];
+            blockers = (blockers - masks[square]) & masks[square];
+        } while(blockers != 0);
+    }
+    return table;
 }
 
-// generates the lookup tables for each square, ran on startup
-void generateLookups() {
-    // loops through each square
-    for(int i = 0; i < 64; i++) {
-        // generate the different blocker patterns
-        std::array<uint64_t, 4096> rookBlockers;
-        int rookPatterns = getRookBlockerCombinations(rookBlockers, rookMasks[i]);
+// the attack tables, each square's slice starts at its offset (see slidey.h)
+// 800KB for rooks and 41KB for bishops, where a 4096 and 512 slot slice for every square took 2MB and 256KB
+constexpr std::array<uint64_t, rookOffsets[64]> pextRookTable = buildPextTable<rookOffsets[64]>(rookMasks, rookOffsets, 0);
+constexpr std::array<uint64_t, bishopOffsets[64]> pextBishopTable = buildPextTable<bishopOffsets[64]>(bishopMasks, bishopOffsets, 4);
+constexpr std::array<uint64_t, rookOffsets[64]> magicRookTable = buildMagicTable(pextRookTable, rookMasks, rookOffsets, rookMagics);
+constexpr std::array<uint64_t, bishopOffsets[64]> magicBishopTable = buildMagicTable(pextBishopTable, bishopMasks, bishopOffsets, bishopMagics);
+std::array<uint16_t, rookOffsets[64]> compressedRookTable;
+std::array<uint16_t, bishopOffsets[64]> compressedBishopTable;
+std::vector<std::array<uint64_t, 4096>> flatRookTable;
+std::vector<std::array<uint64_t, 512>> flatBishopTable;
 
-        // calculate the moves for each one
-        for(int j = 0; j < rookPatterns; j++) {
-            rookAttackLookup[i][calculateRookIndex(rookBlockers[j], i)] = getRookAttacksOld(i, rookBlockers[j]);
-        }
+static_assert(std::ranges::all_of(rookReach, [](uint64_t reach) { return std::popcount(reach) <= 16; }), "the compressed layout needs every reach to fit in 16 bits");
+static_assert(std::ranges::all_of(bishopReach, [](uint64_t reach) { return std::popcount(reach) <= 16; }), "the compressed layout needs every reach to fit in 16 bits");
 
-        // bishop blocker patterns
-        std::array<uint64_t, 512> bishopBlockers;
-        int bishopPatterns = getBishopBlockerCombinations(bishopBlockers, bishopMasks[i]);
+SliderLayout sliderLayout = SliderLayout::Magic;
 
-        // calculate the moves for each one
-        for(int j = 0; j < bishopPatterns; j++) {
-            bishopAttackLookup[i][calculateBishopIndex(bishopBlockers[j], i)] = getBishopAttacksOld(i, bishopBlockers[j]);
+// packs the pext tables down for the compressed layout
+void fillCompressedLookups() {
+    for(int i = 0; i < 64; i++) {
+        for(uint32_t j = rookOffsets[i]; j < rookOffsets[i + 1]; j++) {
+            compressedRookTable[j] = pext(pextRookTable[j], rookReach[i]);
+        }
+        for(uint32_t j = bishopOffsets[i]; j < bishopOffsets[i + 1]; j++) {
+            compressedBishopTable[j] = pext(pextBishopTable[j], bishopReach[i]);
         }
     }
 }
 
-// uses magic to calculate the index for each square and blockers
-uint64_t calculateRookIndex(const uint64_t occupiedBitboard, const int square) {
-    return ((occupiedBitboard & rookMasks[square]) * rookMagics[square]) >> (64 - __builtin_popcountll(rookMasks[square]));
+// copies one of the offset tables out into a slice per square, each slice is laid out the same so the indices carry over
+template <size_t Slots, size_t Size>
+void fillFlatLookups(std::vector<std::array<uint64_t, Slots>> &flat, const std::array<uint64_t, Size> &table, const std::array<uint32_t, 65> &offsets) {
+    flat.assign(64, {});
+    for(int i = 0; i < 64; i++) {
+        std::copy(table.begin() + offsets[i], table.begin() + offsets[i + 1], flat[i].begin());
+    }
+}
+
+// picks how the tables get read, ran on startup
+void generateLookups() {
+    sliderLayout = pextIsFast() ? SliderLayout::Pext : SliderLayout::Magic;
+}
+
+bool setSliderLayout(const SliderLayout layout) {
+    if(layout != SliderLayout::Magic && layout != SliderLayout::FlatMagic && !pextIsSupported()) return false;
+    if(layout == SliderLayout::CompressedPext) fillCompressedLookups();
+    if(layout == SliderLayout::FlatMagic || layout == SliderLayout::FlatPext) {
+        const bool magic = layout == SliderLayout::FlatMagic;
+        fillFlatLookups(flatRookTable, magic ? magicRookTable : pextRookTable, rookOffsets);
+        fillFlatLookups(flatBishopTable, magic ? magicBishopTable : pextBishopTable, bishopOffsets);
+    }
+    sliderLayout = layout;
+    // nothing reads the flat tables any more, so they don't need to hang around
+    if(layout != SliderLayout::FlatMagic && layout != SliderLayout::FlatPext) {
+        std::vector<std::array<uint64_t, 4096>>().swap(flatRookTable);
+        std::vector<std::array<uint64_t, 512>>().swap(flatBishopTable);
+    }
+    return true;
+}
+
+std::string_view sliderLayoutName(const SliderLayout layout) {
+    switch(layout) {
+        case SliderLayout::Pext: return "pext";
+        case SliderLayout::CompressedPext: return "pext16";
+        case SliderLayout::FlatMagic: return "flat magic";
+        case SliderLayout::FlatPext: return "flat pext";
+        default: return "magic";
+    }
 }
 
-uint64_t calculateBishopIndex(const uint64_t occupiedBitboard, const int square) {
-    return ((occupiedBitboard & bishopMasks[square]) * bishopMagics[square]) >> (64 - __builtin_popcountll(bishopMasks[square]));
+std::string_view sliderPath() {
+    return sliderLayoutName(sliderLayout);
 }
 
 // gets the attacks from the tables so the values don't have to be public
+// magics are done here so they can be inlined, the pext ones have to go through bmi2.cpp
 uint64_t getRookAttacksFromTable(const uint64_t occupiedBitboard, const int square) {
-    return rookAttackLookup[square][calculateRookIndex(occupiedBitboard, square)];
+    if(sliderLayout == SliderLayout::Pext) [[likely]] return pextRookAttacks(occupiedBitboard, square);
+    const uint64_t magicIndex = ((occupiedBitboard & rookMasks[square]) * rookMagics[square]) >> (64 - std::popcount(rookMasks[square]));
+    if(sliderLayout == SliderLayout::Magic) [[likely]] return magicRookTable[rookOffsets[square] + magicIndex];
+    if(sliderLayout == SliderLayout::CompressedPext) return compressedRookAttacks(occupiedBitboard, square);
+    if(sliderLayout == SliderLayout::FlatPext) return flatPextRookAttacks(occupiedBitboard, square);
+    return flatRookTable[square][magicIndex];
 }
 
 uint64_t getBishopAttacksFromTable(const uint64_t occupiedBitboard, const int square) {
-    return bishopAttackLookup[square][calculateBishopIndex(occupiedBitboard, square)];
+    if(sliderLayout == SliderLayout::Pext) [[likely]] return pextBishopAttacks(occupiedBitboard, square);
+    const uint64_t magicIndex = ((occupiedBitboard & bishopMasks[square]) * bishopMagics[square]) >> (64 - std::popcount(bishopMasks[square]));
+    if(sliderLayout == SliderLayout::Magic) [[likely]] return magicBishopTable[bishopOffsets[square] + magicIndex];
+    if(sliderLayout == SliderLayout::CompressedPext) return compressedBishopAttacks(occupiedBitboard, square);
+    if(sliderLayout == SliderLayout::FlatPext) return flatPextBishopAttacks(occupiedBitboard, square);
+    return flatBishopTable[square][magicIndex];
 }
@@ -20,30 +20,10 @@
 
 // classical approach move generation
 uint64_t getRookAttacksOld(int square, uint64_t occupiedBitboard) {
-	uint64_t attacks = 0;
-	for(int direction = 0; direction < 4; direction++) {
-		uint64_t currentAttack = slideyPieceRays[direction][square];
-		if((direction & 1) == 0) {
-			currentAttack ^= slideyPieceRays[direction][std::clamp(std::countr_zero(currentAttack & occupiedBitboard), 0, 63)];
-		} else {
-			currentAttack ^= slideyPieceRays[direction][std::clamp(63 - std::countl_zero(currentAttack & occupiedBitboard), 0, 63)];
-		}
-		attacks |= currentAttack;
-    }
-	return attacks;
+    return rayAttacks(square, occupiedBitboard, 0);
 }
 uint64_t getBishopAttacksOld(int square, uint64_t occupiedBitboard) {
-	uint64_t attacks = 0;
-	for(int direction = 4; direction < 8; direction++) {
-		uint64_t currentAttack = slideyPieceRays[direction][square];
-		if((direction & 1) == 0) {
-			currentAttack ^= slideyPieceRays[direction][std::clamp(std::countr_zero(currentAttack & occupiedBitboard), 0, 63)];
-		} else {
-			currentAttack ^= slideyPieceRays[direction][std::clamp(63 - std::countl_zero(currentAttack & occupiedBitboard), 0, 63)];
-		}
-		attacks |= currentAttack;
-    }
-	return attacks;
+    return rayAttacks(square, occupiedBitboard, 4);
 }
 // this is getting the attacks from either pext or magic bitboard move generation, which is decided by which build is being done
 uint64_t getRookAttacks(int square, uint64_t occupiedBitboard) {
@@ -54,6 +34,19 @@ uint64_t getBishopAttacks(int square, uint64_t occupiedBitboard) {
     assert(square < 64);
     return getBishopAttacksFromTable(occupiedBitboard, square);
 }
+// the squares strictly between two squares on the same rank, file or diagonal, and nothing if they don't share a line
+// found by looking from each square towards the other with only the other one in the way, where the two rays overlap is the gap between them
+uint64_t getBetween(int square1, int square2) {
+    const uint64_t bitboard1 = 1ULL << square1;
+    const uint64_t bitboard2 = 1ULL << square2;
+    if(getRookAttacks(square1, 0) & bitboard2) {
+        return getRookAttacks(square1, bitboard2) & getRookAttacks(square2, bitboard1);
+    }
+    if(getBishopAttacks(square1, 0) & bitboard2) {
+        return getBishopAttacks(square1, bitboard2) & getBishopAttacks(square2, bitboard1);
+    }
+    return 0;
+}
 // pawn pushes
 uint64_t getPawnPushes(uint64_t pawnBitboard, uint64_t emptyBitboard, int colorToMove) {
 	return (colorToMove == 0 ? pawnBitboard >> 8 : pawnBitboard << 8) & emptyBitboard;
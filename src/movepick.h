@@ -28,7 +28,9 @@ constexpr int counterScore = historyCap * 5 + 1;
 constexpr int goodCaptureBonus= 500000;
 
 enum class MovegenStage : int {
-    TTMove = 0,
+    // in check, every legal move gets generated up front and then handed out by the usual stages below, but only ever from that list
+    GenEvasions = 0,
+    TTMove,
     GenNoisy,
     GoodNoisy,
     Killer,
@@ -48,17 +50,27 @@ class MovePicker {
 public:
      std::pair<Move, int> next() {
         switch(stage) {
+            case MovegenStage::GenEvasions: {
+                generateEvasions();
+
+                ++stage;
+                [[fallthrough]];
+            }
             case MovegenStage::TTMove: {
                 ++stage;
-                if(ttMove && board.isPseudolegal(ttMove)) {
+                if(ttMove && isCandidate(ttMove)) {
                     return {ttMove, 1000000000};
                 }
                 [[fallthrough]];
             }
             case MovegenStage::GenNoisy: {
                 idx = 0;
-                totalMoves = board.getNoisies(moves, 0);
-                noisyEnd = totalMoves;
+                if(evasions) {
+                    totalMoves = noisyEnd;
+                } else {
+                    totalMoves = board.getNoisies(moves, 0);
+                    noisyEnd = totalMoves;
+                }
                 scoreNoisies();
 
                 ++stage;
@@ -73,6 +85,7 @@ public:
                     if(move == counter) counterGenerated = true;
 
                     if(score > (goodCaptureBonus - historyCap - MVV_values[Queen]->value)) {
+                        if(!isLegal(move)) continue;
                         return {move, score};
                     } else {
                         idx--;
@@ -85,21 +98,22 @@ public:
             }
             case MovegenStage::Killer: {
                 ++stage;
-                if(killer && board.isPseudolegal(killer) && killer != ttMove && !killerGenerated) {
+                if(killer && isCandidate(killer) && killer != ttMove && !killerGenerated) {
                     return {killer, killerScore};
                 }
                 [[fallthrough]];
             }
             case MovegenStage::Counter: {
                 ++stage;
-                if(counter && board.isPseudolegal(counter) && counter != ttMove && counter != killer && !counterGenerated) {
+                if(counter && isCandidate(counter) && counter != ttMove && counter != killer && !counterGenerated) {
                     return {counter, counterScore};
                 }
                 [[fallthrough]];
             }
             case MovegenStage::GenQuiet: {
                 if(!skipQuiets) {
-                    totalMoves = board.getQuiets(moves, totalMoves);
+                    // the evasions that aren't captures are already sitting after the noisy ones
+                    totalMoves = evasions ? evasionEnd : board.getQuiets(moves, totalMoves);
                     // scores the newly generated quiets
                     scoreQuiets();
                 }
@@ -117,6 +131,7 @@ public:
                         bool isQuiet = (!isCapture && (move.getFlag() <= DoublePawnPush));
                         if(isQuiet) continue;
                     }
+                    if(!isLegal(move)) continue;
                     return {move, score};
                 }
                 
@@ -131,14 +146,19 @@ public:
                 [[fallthrough]];
             }
             case MovegenStage::QSAll: {
-                return getNextInternal();
+                while(idx < totalMoves) {
+                    auto [move, score] = getNextInternal();
+                    if(!isLegal(move)) continue;
+                    return {move, score};
+                }
+                return {Move(), 0};
             }
             default:
                 return {Move(), 0};
         }
     }
     static MovePicker search(const Board &board, const Move ttMove, SearchInfo &tables, const int ply) {
-        return MovePicker(board, ttMove, tables, MovegenStage::TTMove, ply);
+        return MovePicker(board, ttMove, tables, board.isInCheck() ? MovegenStage::GenEvasions : MovegenStage::TTMove, ply);
     }
     static MovePicker qsearch(const Board &board, const Move ttMove, SearchInfo &tables) {
         return MovePicker(board, ttMove, tables, MovegenStage::QSGenAll, 0);
@@ -151,9 +171,40 @@ private:
     explicit MovePicker(const Board &board, const Move ttMove, SearchInfo &tables, const MovegenStage stage, const int ply) : stage(stage),
     board{board}, ttMove(ttMove), idx{0}, totalMoves{0}, info{tables}, killer{info.stack[ply].killer}, 
     counter{ply > 0 ? info.counterMoves[info.stack[ply - 1].move.getStartSquare()][info.stack[ply - 1].move.getEndSquare()] : Move()}, 
-    ply(ply) {}
+    ply(ply), evasions(stage == MovegenStage::GenEvasions),
+    pinned{evasions ? 0 : board.getPinned()}, checkers{evasions ? 0 : board.getCheckers()} {}
+    // splits the legal moves into the noisy ones and then the quiets, each in the order getNoisies and getQuiets would have given them
+    void generateEvasions() {
+        std::array<Move, 256> legal;
+        const int count = board.getLegalMoves(legal);
+        std::array<Move, 256> quiets;
+        int quietCount = 0;
+        noisyEnd = 0;
+        for(int i = 0; i < count; i++) {
+            const Move move = legal[i];
+            const bool isCapture = board.pieceAtIndex(move.getEndSquare()) != None || move.getFlag() == EnPassant;
+            if(isCapture) {
+                moves[noisyEnd++] = move;
+            } else {
+                quiets[quietCount++] = move;
+            }
+        }
+        std::copy_n(quiets.begin(), quietCount, moves.begin() + noisyEnd);
+        evasionEnd = noisyEnd + quietCount;
+    }
+    // moves from the tt or the killer tables only get played if they could be played here, which for evasions means being in the list
+    bool isCandidate(const Move move) const {
+        if(!evasions) return board.isPseudolegal(move) && board.isLegal(move, pinned, checkers);
+        return std::find(moves.begin(), moves.begin() + evasionEnd, move) != moves.begin() + evasionEnd;
+    }
+    // getNoisies, getQuiets and getMovesQSearch don't care about the king, so their moves get checked against the pins here as they're handed out
+    // that way everything next() gives back is legal, and can be played without makeMove looking for the check afterwards
+    bool isLegal(const Move move) const {
+        return evasions || board.isLegal(move, pinned, checkers);
+    }
     void scoreNoisies() {
         const int colorToMove = board.getColorToMove();
+        const uint64_t threats = board.getThreats();
         for(int i = idx; i < totalMoves; i++) {
             Move move = moves[i];
             const int end = move.getEndSquare();
@@ -162,7 +213,7 @@ private:
             // Captures!
             const int victim = getType(board.pieceAtIndex(end));
             // Capthist!
-            moveScores[i] = MVV_values[victim]->value + info.noisyHistoryTable[colorToMove][piece][end][victim][board.squareIsUnderAttack(end)];
+            moveScores[i] = MVV_values[victim]->value + info.noisyHistoryTable[colorToMove][piece][end][victim][(threats >> end) & 1];
             // see!
             // try a threshold here someday
             if(see(board, move, 0)) {
@@ -173,6 +224,7 @@ private:
     }
     void scoreQuiets() {
         const int colorToMove = board.getColorToMove();
+        const uint64_t threats = board.getThreats();
         for(int i = noisyEnd; i < totalMoves; i++) {
             Move move = moves[i];
             const int end = move.getEndSquare();
@@ -180,7 +232,7 @@ private:
             const int piece = getType(board.pieceAtIndex(start));
             int hash = board.getPawnHashIndex();
             // read from history
-            moveScores[i] = info.historyTable[colorToMove][start][board.squareIsUnderAttack(start)][end][board.squareIsUnderAttack(end)]
+            moveScores[i] = info.historyTable[colorToMove][start][(threats >> start) & 1][end][(threats >> end) & 1]
                 + (ply > 0 ? (*info.stack[ply - 1].ch_entry)[colorToMove][piece][end] : 0)
                 + (ply > 1 ? (*info.stack[ply - 2].ch_entry)[colorToMove][piece][end] : 0)
                 + (ply > 3 ? (*info.stack[ply - 4].ch_entry)[colorToMove][piece][end] : 0)
@@ -233,6 +285,10 @@ private:
     bool counterGenerated = false;
     int ply;
     int noisyEnd = 0;
+    bool evasions;
+    int evasionEnd = 0;
+    uint64_t pinned;
+    uint64_t checkers;
     std::array<Move, 256> moves;
     std::array<int, 256> moveScores;
 };
\ No newline at end of file
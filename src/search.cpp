@@ -35,9 +35,9 @@ uint64_t hardNodeCap = 400000;
 void Engine::clearHistory() {
     std::memset(info.historyTable.data(), 0, sizeof(info.historyTable));
     std::memset(info.noisyHistoryTable.data(), 0, sizeof(info.noisyHistoryTable));
-    std::memset(info.conthistTable.get(), 0, sizeof(info.conthistTable));
+    std::memset(info.conthistTable.data(), 0, info.conthistTable.bytes());
     std::memset(info.qsHistoryTable.data(), 0, sizeof(info.qsHistoryTable));
-    std::memset(info.pawnHistoryTable.data(), 0, sizeof(info.pawnHistoryTable));
+    std::memset(info.pawnHistoryTable.data(), 0, info.pawnHistoryTable.bytes());
     info.corrhist.clear();
 }
 
@@ -51,12 +51,30 @@ void Engine::resetEngine() {
     std::memset(nodeTMTable.data(), 0, sizeof(nodeTMTable));
     std::memset(info.counterMoves.data(), 0, sizeof(info.counterMoves));
     clearHistory(); 
+    ttStats = TTStats();
+    evalCache.clear();
+}
+
+void Engine::startReset() {
+    waitForReset();
+    resetDone = std::async(std::launch::async, [this]() {
+        resetEngine();
+    }).share();
+}
+
+void Engine::waitForReset() const {
+    if(resetDone.valid()) resetDone.wait();
 }
 
 // Quiecense search, searching all the captures until there aren't anymore so that you can get an accurate eval
 int16_t Engine::qSearch(Board &board, int alpha, int beta, int16_t ply) {
     info.stack[ply].pvLength = 0;
     //if(board.isRepeatedPosition()) return 0;
+    // same as in negamax, the move back isn't a capture but it can still be played instead of anything here
+    if(alpha < 0 && board.hasUpcomingRepetition()) {
+        alpha = 0;
+        if(alpha >= beta) return alpha;
+    }
     // time check every 4096 nodes
     if(useNodeCap) {
         if(nodes > hardNodeCap) {
@@ -74,22 +92,26 @@ int16_t Engine::qSearch(Board &board, int alpha, int beta, int16_t ply) {
     if(ply > seldepth) seldepth = ply;
     const uint64_t hash = board.getZobristHash();
     // TT check
-    Transposition* entry = TT->getEntry(hash);
-
-    if(entry->zobristKey == shrink(hash) && (
-        entry->flag == Exact // exact score
-            || (entry->flag == BetaCutoff && entry->score >= beta) // lower bound, fail high
-            || (entry->flag == FailLow && entry->score <= alpha) // upper bound, fail low
+    Transposition entry;
+    const bool ttHit = TT->probe(hash, entry);
+    ttStats.add(Probes);
+    if(ttHit) ttStats.add(Hits);
+
+    if(ttHit && (
+        entry.flag == Exact // exact score
+            || (entry.flag == BetaCutoff && entry.score >= beta) // lower bound, fail high
+            || (entry.flag == FailLow && entry.score <= alpha) // upper bound, fail low
     )) {
-        return entry->score;
+        ttStats.add(Cutoffs);
+        return entry.score;
     }
 
     // stand pat shenanigans
     int staticEval = 0;
-    if(entry->zobristKey == shrink(hash)) {
-        staticEval = entry->staticEval;
+    if(ttHit) {
+        staticEval = entry.staticEval;
     } else {
-        staticEval = board.getEvaluation();
+        staticEval = board.getEvaluation(evalCache);
     }
     if(ply > depthLimit - 1) return staticEval;
 
@@ -102,12 +124,12 @@ int16_t Engine::qSearch(Board &board, int alpha, int beta, int16_t ply) {
     staticEval = info.corrhist.correct(ctm, chpawnHash, staticEval, nonPawnHash, majorHash, minorHash);
 
     // adjust staticEval to TT score if it's good enough
-    if(shrink(hash) == entry->zobristKey && (
-        entry->flag == Exact ||
-        (entry->flag == BetaCutoff && entry->score >= staticEval) ||
-        (entry->flag == FailLow && entry->score <= staticEval)
+    if(ttHit && (
+        entry.flag == Exact ||
+        (entry.flag == BetaCutoff && entry.score >= staticEval) ||
+        (entry.flag == FailLow && entry.score <= staticEval)
     )) {
-        staticEval = entry->score;
+        staticEval = entry.score;
     }
 
 
@@ -121,7 +143,7 @@ int16_t Engine::qSearch(Board &board, int alpha, int beta, int16_t ply) {
     
     int legalMoves = 0;
     std::array<Move, 256> testedMoves;
-    MovePicker picker = MovePicker::qsearch(board, entry->bestMove, info);
+    MovePicker picker = MovePicker::qsearch(board, entry.bestMove, info);
     // loop though all the moves
     while (true) {
         auto [move, unused] = picker.next();
@@ -133,13 +155,13 @@ int16_t Engine::qSearch(Board &board, int alpha, int beta, int16_t ply) {
 
         // TT prefetching
         uint64_t afterKey = board.keyAfter(move);
-        __builtin_prefetch(TT->getEntry(afterKey));
+        TT->prefetch(afterKey);
+        board.prefetchFeatures(move);
 
         // History Pruning
         //if(moveValues[i] < qhpDepthMultiplier.value * qDepth) break;
-        if(!board.makeMove<true>(move)) {
-            continue;
-        }
+        // the picker only hands out legal moves
+        board.makeMove<true, false>(move);
         testedMoves[legalMoves] = move;
         legalMoves++;
         nodes++;
@@ -193,8 +215,9 @@ int16_t Engine::qSearch(Board &board, int alpha, int beta, int16_t ply) {
     }
 
     // push to TT
-    Transposition entryToWrite = Transposition(hash, bestMove, flag, staticEval, bestScore, 0);
-    TT->setEntry(hash, entryToWrite);
+    Transposition entryToWrite = Transposition(bestMove, flag, staticEval, bestScore, 0);
+    ttStats.add(QSWrites);
+    TT->setEntry(hash, entryToWrite, &ttStats);
 
     return bestScore;
 }
@@ -242,6 +265,11 @@ int16_t Engine::negamax(Board &board, int depth, int alpha, int beta, int16_t pl
     info.stack[ply].pvLength = 0;
     // if it's a repeated position, it's a draw
     if(ply > 0 && (board.getFiftyMoveCount() >= 50 || board.isRepeatedPosition())) return 0;
+    // if a move can get back to a position from earlier, this can't be worse than a draw
+    if(ply > 0 && alpha < 0 && board.hasUpcomingRepetition()) {
+        alpha = 0;
+        if(alpha >= beta) return alpha;
+    }
     // time check every 4096 nodes
     if(useNodeCap) {
         if(nodes >= hardNodeCap) {
@@ -266,34 +294,38 @@ int16_t Engine::negamax(Board &board, int depth, int alpha, int beta, int16_t pl
     const uint64_t hash = board.getZobristHash();
 
     // TT check
-    Transposition* entry = nullptr;
-    
-    if(!inSingularSearch) entry = TT->getEntry(hash);
+    Transposition entry;
+    const bool ttHit = !inSingularSearch && TT->probe(hash, entry);
+    if(!inSingularSearch) ttStats.add(Probes);
+    if(ttHit) ttStats.add(Hits);
 
     // if it meets these criteria, it's done the search exactly the same way before, if not more throuroughly in the past and you can skip it
     // it would make sense to add !isPV here, however from my testing that makes it about 80 elo worse
     // turns out that score above was complete bs lol, my isPV was broken
-    if(!isPV && !inSingularSearch && ply > 0 && entry->zobristKey == shrink(hash) && entry->depth >= depth && (
-            entry->flag == Exact // exact score
-                || (entry->flag == BetaCutoff && entry->score >= beta) // lower bound, fail high
-                || (entry->flag == FailLow && entry->score <= alpha) // upper bound, fail low
+    if(!isPV && !inSingularSearch && ply > 0 && ttHit && entry.depth >= depth && (
+            entry.flag == Exact // exact score
+                || (entry.flag == BetaCutoff && entry.score >= beta) // lower bound, fail high
+                || (entry.flag == FailLow && entry.score <= alpha) // upper bound, fail low
         )) {
-        return entry->score; 
+        ttStats.add(Cutoffs);
+        return entry.score; 
     }
 
     // Internal Iterative Reduction (IIR)
     // Things to test: alternative depth
-    if(!inSingularSearch && (entry->zobristKey != shrink(hash) || entry->bestMove == Move()) && depth > iirDepthCondition.value) depth--;
+    if(!inSingularSearch && (!ttHit || entry.bestMove == Move()) && depth > iirDepthCondition.value) depth--;
 
     int staticEval = 0;
     int originalStaticEval = 0;
-    if(!inSingularSearch && entry->zobristKey == shrink(hash)) {
-        staticEval = entry->staticEval;
+    if(ttHit) {
+        staticEval = entry.staticEval;
     } else {
-        staticEval = board.getEvaluation();
-        if(!inSingularSearch && entry->zobristKey == 0) {
-            Transposition entryToWrite = Transposition(hash, Move(), 0, staticEval, 0, 0);
-            TT->setEntry(hash, entryToWrite);
+        staticEval = board.getEvaluation(evalCache);
+        // setEntry only puts this in an empty slot
+        if(!inSingularSearch) {
+            Transposition entryToWrite = Transposition(Move(), 0, staticEval, 0, 0);
+            ttStats.add(MainWrites);
+            TT->setEntry(hash, entryToWrite, &ttStats);
         }
     }
     originalStaticEval = staticEval;
@@ -326,12 +358,12 @@ int16_t Engine::negamax(Board &board, int depth, int alpha, int beta, int16_t pl
     }
 
     // adjust staticEval to TT score if it's good enough
-    if(!inCheck && !inSingularSearch && shrink(hash) == entry->zobristKey && (
-        entry->flag == Exact ||
-        (entry->flag == BetaCutoff && entry->score >= staticEval) ||
-        (entry->flag == FailLow && entry->score <= staticEval)
+    if(!inCheck && !inSingularSearch && ttHit && (
+        entry.flag == Exact ||
+        (entry.flag == BetaCutoff && entry.score >= staticEval) ||
+        (entry.flag == FailLow && entry.score <= staticEval)
     )) {
-        staticEval = entry->score;
+        staticEval = entry.score;
     }
 
     // Razoring
@@ -353,7 +385,7 @@ int16_t Engine::negamax(Board &board, int depth, int alpha, int beta, int16_t pl
     // Things to test: !isPV, alternate formulas, etc
     // "I could probably detect zugzwang here but ehhhhh" -Me, a few months ago
     if(!isPV && !inSingularSearch && !board.isPKEndgame() && nmpAllowed && depth >= nmpDepthCondition.value && !inCheck && staticEval >= beta && staticEval >= beta + 175 - 25 * depth) {
-        info.stack[ply].ch_entry = &(*info.conthistTable)[0][0][0][0];
+        info.stack[ply].ch_entry = &info.conthistTable[0][0][0][0];
         info.stack[ply].move = Move();
         board.changeColor();
         const int score = -negamax(board, depth - 3 - depth / 3 - std::min((staticEval - beta) / int(nmpDivisor.value), int(nmpSubtractor.value)), 0-beta, 1-beta, ply + 1, false, !isCutNode);
@@ -384,17 +416,19 @@ int16_t Engine::negamax(Board &board, int depth, int alpha, int beta, int16_t pl
     }
     // capturable squares to determine if a move is a capture.
     const uint64_t capturable = board.getOccupiedBitboard();
+    // the squares the opponent attacks, looked up once for the whole move loop instead of for every history index
+    const uint64_t threats = board.getThreats();
     // loop through the moves
     int legalMoves = 0;
     std::array<Move, 256> testedMoves;
-    MovePicker picker = MovePicker::search(board, inSingularSearch ? Move() : entry->bestMove, info, ply);
+    MovePicker picker = MovePicker::search(board, inSingularSearch ? Move() : entry.bestMove, info, ply);
     while (true) {
         auto [move, moveValue] = picker.next();
         if (!move) break;
         if(move == info.stack[ply].excluded) continue;
         int moveStartSquare = move.getStartSquare();
         int moveEndSquare = move.getEndSquare();
-        bool moveEndAttack = board.squareIsUnderAttack(moveEndSquare);
+        bool moveEndAttack = (threats >> moveEndSquare) & 1;
         int moveFlag = move.getFlag();
         bool isCapture = ((capturable & (1ULL << moveEndSquare)) != 0) || moveFlag == EnPassant;
         bool isQuiet = (!isCapture && (moveFlag <= DoublePawnPush));
@@ -416,15 +450,16 @@ int16_t Engine::negamax(Board &board, int depth, int alpha, int beta, int16_t pl
 
         // TT prefetching
         uint64_t afterKey = board.keyAfter(move);
-        __builtin_prefetch(TT->getEntry(afterKey));
+        TT->prefetch(afterKey);
+        board.prefetchFeatures(move);
 
         int TTExtensions = 0;
         // determine whether or not to extend TT move (Singular Extensions)
-        if(!inSingularSearch && entry->bestMove == move && depth >= sinDepthCondition.value && entry->depth >= depth - sinDepthMargin.value && entry->flag != FailLow) {
-            const auto sBeta = std::max(matedScore, int16_t(entry->score - depth * int(sinDepthScale.value) / 16));
+        if(!inSingularSearch && entry.bestMove == move && depth >= sinDepthCondition.value && entry.depth >= depth - sinDepthMargin.value && entry.flag != FailLow) {
+            const auto sBeta = std::max(matedScore, int16_t(entry.score - depth * int(sinDepthScale.value) / 16));
             const auto sDepth = (depth - 1) / 2;
 
-            info.stack[ply].excluded = entry->bestMove;
+            info.stack[ply].excluded = entry.bestMove;
             const auto score = negamax(board, sDepth, sBeta - 1, sBeta, ply, true, isCutNode);
             info.stack[ply].excluded = Move();
             if(score < sBeta) {
@@ -438,7 +473,7 @@ int16_t Engine::negamax(Board &board, int depth, int alpha, int beta, int16_t pl
             } else if(sBeta >= beta) {
                 // multicut!
                 return sBeta;
-            } else if(entry->score >= beta) {
+            } else if(entry.score >= beta) {
                 // negative extensions!
                 TTExtensions = -2;
             } else if(isCutNode) {
@@ -446,11 +481,9 @@ int16_t Engine::negamax(Board &board, int depth, int alpha, int beta, int16_t pl
             }
         }
 
-        if(!board.makeMove<true>(move)) {
-            continue;
-        }
+        board.makeMove<true, false>(move);
 
-        info.stack[ply].ch_entry = &(*info.conthistTable)[board.getColorToMove()][getType(board.pieceAtIndex(moveEndSquare))][moveEndSquare][moveVictim];
+        info.stack[ply].ch_entry = &info.conthistTable[board.getColorToMove()][getType(board.pieceAtIndex(moveEndSquare))][moveEndSquare][moveVictim];
         info.stack[ply].move = move;
         testedMoves[legalMoves] = move;
         legalMoves++;
@@ -470,7 +503,9 @@ int16_t Engine::negamax(Board &board, int depth, int alpha, int beta, int16_t pl
                 if(isQuiet) {
                     lmr -= moveValue / int(hmrDivisor.value);
                 } else {
-                    lmr -= info.historyTable[1 - board.getColorToMove()][moveStartSquare][board.squareIsUnderAttack(moveStartSquare)][moveEndSquare][board.squareIsUnderAttack(moveEndSquare)] / int(cmrDivisor.value);
+                    // the move has already been made, so these are the threats of the position after it
+                    const uint64_t childThreats = board.getThreats();
+                    lmr -= info.historyTable[1 - board.getColorToMove()][moveStartSquare][(childThreats >> moveStartSquare) & 1][moveEndSquare][(childThreats >> moveEndSquare) & 1] / int(cmrDivisor.value);
                 }
                 lmr += isCutNode * 2;
                 lmr -= improving;
@@ -527,7 +562,7 @@ int16_t Engine::negamax(Board &board, int depth, int alpha, int beta, int16_t pl
                         int start = moveStartSquare;
                         int end = moveEndSquare;
                         int piece = getType(board.pieceAtIndex(start));
-                        updateHistory(colorToMove, start, end, piece, bonus, ply, hash, board.squareIsUnderAttack(start), moveEndAttack);
+                        updateHistory(colorToMove, start, end, piece, bonus, ply, hash, (threats >> start) & 1, moveEndAttack);
                         info.stack[ply].killer = move;
                         if(ply > 0) info.counterMoves[info.stack[ply - 1].move.getStartSquare()][info.stack[ply - 1].move.getEndSquare()] = move;
                     } else if (move.getFlag() < promotions[0] || move.getFlag() == promotions[3]) {
@@ -547,10 +582,10 @@ int16_t Engine::negamax(Board &board, int depth, int alpha, int beta, int16_t pl
                         bool maluIsCapture = ((capturable & (1ULL << end)) != 0) || flag == EnPassant;
                         bool maluIsQuiet = (!maluIsCapture && (flag <= DoublePawnPush));
                         if(maluIsQuiet) {
-                            updateHistory(colorToMove, start, end, piece, bonus, ply, hash, board.squareIsUnderAttack(start), board.squareIsUnderAttack(end));
+                            updateHistory(colorToMove, start, end, piece, bonus, ply, hash, (threats >> start) & 1, (threats >> end) & 1);
                         } else if(maluMove.getFlag() < promotions[0] || maluMove.getFlag() == promotions[3]) {
                             const int victim = getType(board.pieceAtIndex(end));
-                            updateNoisyHistory(colorToMove, piece, end, victim, bonus, board.squareIsUnderAttack(end));
+                            updateNoisyHistory(colorToMove, piece, end, victim, bonus, (threats >> end) & 1);
                         }
                     }
                     break;
@@ -575,9 +610,10 @@ int16_t Engine::negamax(Board &board, int depth, int alpha, int beta, int16_t pl
 
     // push to TT
     if(!inSingularSearch) {
-        if(entry->zobristKey == shrink(hash) && entry->bestMove != Move() && bestMove == Move()) bestMove = entry->bestMove;
-        Transposition entryToWrite = Transposition(hash, bestMove, flag, originalStaticEval, bestScore, depth);
-        TT->setEntry(hash, entryToWrite);
+        if(ttHit && entry.bestMove != Move() && bestMove == Move()) bestMove = entry.bestMove;
+        Transposition entryToWrite = Transposition(bestMove, flag, originalStaticEval, bestScore, depth);
+        ttStats.add(MainWrites);
+        TT->setEntry(hash, entryToWrite, &ttStats);
     }
 
     return bestScore;
@@ -608,7 +644,7 @@ void Engine::outputInfo(const Board& board, int score, int depth, int elapsedTim
         scoreString += std::to_string((abs(abs(score) + matedScore) / 2 + board.getColorToMove()) * colorMultiplier);
     }
     uint64_t nodeSum = getTotalNodes();
-    std::cout << "info depth " << std::to_string(depth) << " seldepth " << std::to_string(seldepth) << " nodes " << std::to_string(nodeSum) << " time " << std::to_string(elapsedTime) << " nps " << std::to_string(int(double(nodeSum) / (elapsedTime == 0 ? 1 : elapsedTime) * 1000)) << scoreString << " pv " << getPV() << std::endl;
+    std::cout << "info depth " << std::to_string(depth) << " seldepth " << std::to_string(seldepth) << " nodes " << std::to_string(nodeSum) << " time " << std::to_string(elapsedTime) << " nps " << std::to_string(int(double(nodeSum) / (elapsedTime == 0 ? 1 : elapsedTime) * 1000)) << " hashfull " << TT->hashfull() << scoreString << " pv " << getPV() << std::endl;
 }
 
 // the usual search function, where you give it the amount of time it has left, and it will search in increasing depth steps until it runs out of time
@@ -698,6 +734,7 @@ Move Engine::think(Board board, int softBound, int hardBound, bool printInfo) {
 
 // searches done for bench, returns the number of nodes searched.
 int Engine::benchSearch(Board board, int depthToSearch) {
+    TT->incrementAge();
     info.stack[0].doubleExtensions = 0;
     //clearHistory();
     nodes = 0;
@@ -818,6 +855,7 @@ Move Engine::fixedDepthSearch(Board board, int depthToSearch, bool printInfo) {
 }
 
 std::pair<Move, int> Engine::dataGenSearch(Board board, uint64_t nodeCap) {
+    TT->incrementAge();
     info.stack[0].doubleExtensions = 0;
     //clearHistory();
     useNodeCap = true;
@@ -28,6 +28,9 @@ constexpr int16_t matedScore = -32000;
 struct Engine {
     public: 
         void resetEngine();
+        // resets on a separate thread, so that ucinewgame doesn't have to wait for every thread's tables to be cleared one by one
+        void startReset();
+        void waitForReset() const;
         Move think(Board board, int softBound, int hardBound, bool info);
         Move getBestMove();
         int benchSearch(Board board, int depthToSearch);
@@ -38,7 +41,13 @@ struct Engine {
             TT = tt;
         }
 
+        PageBacking historyBacking() const {
+            return info.conthistTable.backing();
+        }
+
         uint64_t nodes = 0;
+        TTStats ttStats;
+        EvalCache evalCache;
     private:
         bool useNodeCap = false;
 
@@ -52,6 +61,8 @@ struct Engine {
 
         SearchInfo info;
 
+        std::shared_future<void> resetDone;
+
         std::array<std::array<int, 64>, 64> nodeTMTable;
 
         std::chrono::steady_clock::time_point begin;
@@ -17,11 +17,18 @@
 */
 #pragma once
 
-#include "globals.h"
+#include <immintrin.h>
+#include <cstdint>
+#include <string_view>
 
 #if defined(__AVX512F__) && defined(__AVX512BW__)
 
 using Vector = __m512i;
+#if defined(__AVX512VNNI__)
+constexpr std::string_view simdName = "AVX-512 VNNI";
+#else
+constexpr std::string_view simdName = "AVX-512";
+#endif
 constexpr int weightsPerVector = sizeof(Vector) / sizeof(int16_t); // 32
 
 inline Vector simd_zero() {
@@ -32,6 +39,23 @@ inline Vector simd_load(const Vector *ptr) {
     return _mm512_load_si512(ptr);
 }
 
+inline void simd_store(Vector *ptr, Vector v) {
+    _mm512_store_si512(ptr, v);
+}
+
+// half a vector of int8s, sign extended to int16s
+inline Vector simd_load_epi8_epi16(const int8_t *ptr) {
+    return _mm512_cvtepi8_epi16(_mm256_load_si256(reinterpret_cast<const __m256i *>(ptr)));
+}
+
+inline Vector simd_add_epi16(Vector a, Vector b) {
+    return _mm512_add_epi16(a, b);
+}
+
+inline Vector simd_sub_epi16(Vector a, Vector b) {
+    return _mm512_sub_epi16(a, b);
+}
+
 inline Vector simd_set1_epi16(int16_t v) {
     return _mm512_set1_epi16(v);
 }
@@ -56,6 +80,19 @@ inline Vector simd_add_epi32(Vector a, Vector b) {
     return _mm512_add_epi32(a, b);
 }
 
+// sum + madd(a, b), which vnni does in one instruction
+inline Vector simd_dpwssd_epi32(Vector sum, Vector a, Vector b) {
+#if defined(__AVX512VNNI__)
+    return _mm512_dpwssd_epi32(sum, a, b);
+#else
+    return _mm512_add_epi32(sum, _mm512_madd_epi16(a, b));
+#endif
+}
+
+inline bool simd_is_zero(Vector v) {
+    return _mm512_test_epi16_mask(v, v) == 0;
+}
+
 inline int simd_reduce_add_epi32(Vector v) {
     return _mm512_reduce_add_epi32(v);
 }
@@ -63,6 +100,11 @@ inline int simd_reduce_add_epi32(Vector v) {
 #elif defined(__AVX2__)
 
 using Vector = __m256i;
+#if (defined(__AVX512VNNI__) && defined(__AVX512VL__)) || defined(__AVXVNNI__)
+constexpr std::string_view simdName = "AVX2 VNNI";
+#else
+constexpr std::string_view simdName = "AVX2";
+#endif
 constexpr int weightsPerVector = sizeof(Vector) / sizeof(int16_t); // 16
 
 inline Vector simd_zero() {
@@ -73,6 +115,23 @@ inline Vector simd_load(const Vector *ptr) {
     return _mm256_load_si256(ptr);
 }
 
+inline void simd_store(Vector *ptr, Vector v) {
+    _mm256_store_si256(ptr, v);
+}
+
+// half a vector of int8s, sign extended to int16s
+inline Vector simd_load_epi8_epi16(const int8_t *ptr) {
+    return _mm256_cvtepi8_epi16(_mm_load_si128(reinterpret_cast<const __m128i *>(ptr)));
+}
+
+inline Vector simd_add_epi16(Vector a, Vector b) {
+    return _mm256_add_epi16(a, b);
+}
+
+inline Vector simd_sub_epi16(Vector a, Vector b) {
+    return _mm256_sub_epi16(a, b);
+}
+
 inline Vector simd_set1_epi16(int16_t v) {
     return _mm256_set1_epi16(v);
 }
@@ -97,6 +156,21 @@ inline Vector simd_add_epi32(Vector a, Vector b) {
     return _mm256_add_epi32(a, b);
 }
 
+// sum + madd(a, b), which vnni does in one instruction
+inline Vector simd_dpwssd_epi32(Vector sum, Vector a, Vector b) {
+#if defined(__AVX512VNNI__) && defined(__AVX512VL__)
+    return _mm256_dpwssd_epi32(sum, a, b);
+#elif defined(__AVXVNNI__)
+    return _mm256_dpwssd_avx_epi32(sum, a, b);
+#else
+    return _mm256_add_epi32(sum, _mm256_madd_epi16(a, b));
+#endif
+}
+
+inline bool simd_is_zero(Vector v) {
+    return _mm256_testz_si256(v, v);
+}
+
 inline int simd_reduce_add_epi32(Vector v) {
     // Fold 256-bit → 128-bit → 64-bit → 32-bit
     __m128i lo  = _mm256_castsi256_si128(v);
@@ -112,6 +186,7 @@ inline int simd_reduce_add_epi32(Vector v) {
 #else
 
 using Vector = __m128i;
+constexpr std::string_view simdName = "SSE";
 constexpr int weightsPerVector = sizeof(Vector) / sizeof(int16_t); // 8
 
 inline Vector simd_zero() {
@@ -122,6 +197,25 @@ inline Vector simd_load(const Vector *ptr) {
     return _mm_load_si128(ptr);
 }
 
+inline void simd_store(Vector *ptr, Vector v) {
+    _mm_store_si128(ptr, v);
+}
+
+// half a vector of int8s, sign extended to int16s
+// pmovsxbw is sse4.1, so each byte is doubled up into a word and then shifted back down, which keeps the sign
+inline Vector simd_load_epi8_epi16(const int8_t *ptr) {
+    const Vector bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(ptr));
+    return _mm_srai_epi16(_mm_unpacklo_epi8(bytes, bytes), 8);
+}
+
+inline Vector simd_add_epi16(Vector a, Vector b) {
+    return _mm_add_epi16(a, b);
+}
+
+inline Vector simd_sub_epi16(Vector a, Vector b) {
+    return _mm_sub_epi16(a, b);
+}
+
 inline Vector simd_set1_epi16(int16_t v) {
     return _mm_set1_epi16(v);
 }
@@ -146,6 +240,16 @@ inline Vector simd_add_epi32(Vector a, Vector b) {
     return _mm_add_epi32(a, b);
 }
 
+// sum + madd(a, b), there's no vnni at this width without avx512vl, which would have gone down one of the other paths
+inline Vector simd_dpwssd_epi32(Vector sum, Vector a, Vector b) {
+    return _mm_add_epi32(sum, _mm_madd_epi16(a, b));
+}
+
+// ptest is sse4.1, so this compares against zero instead
+inline bool simd_is_zero(Vector v) {
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) == 0xFFFF;
+}
+
 inline int simd_reduce_add_epi32(Vector v) {
     __m128i hi64 = _mm_unpackhi_epi64(v, v);
     __m128i s    = _mm_add_epi32(v, hi64);
@@ -20,12 +20,83 @@
 #include "globals.h"
 #include "masks.h"
 
-// these functions are used for movegen regardless of pext or magics, and then they are defined in a different file based on which is being used
+// these functions are used for movegen regardless of pext or magics
 
-uint64_t calculateRookIndex(uint64_t occupiedBitboard, int square);
-uint64_t calculateBishopIndex(uint64_t occupiedBitboard, int square);
+// the classical way, following each ray until it hits something, which is slow but can be done by the compiler
+// rooks are directions 0 to 3 and bishops 4 to 7
+constexpr uint64_t rayAttacks(const int square, const uint64_t occupiedBitboard, const int firstDirection) {
+    uint64_t attacks = 0;
+    for(int direction = firstDirection; direction < firstDirection + 4; direction++) {
+        const uint64_t ray = slideyPieceRays[direction][square];
+        const uint64_t blockers = ray & occupiedBitboard;
+        attacks |= ray;
+        // everything past the first blocker is the same ray, starting from the blocker
+        if(blockers != 0) {
+            attacks ^= slideyPieceRays[direction][(direction & 1) == 0 ? std::countr_zero(blockers) : 63 - std::countl_zero(blockers)];
+        }
+    }
+    return attacks;
+}
+
+// every square's attacks sit in one shared table per piece, starting where the last square's stopped
+// and only as long as that square's blocker mask needs, rather than the 4096 or 512 the worst square needs
+constexpr std::array<uint32_t, 65> sliderTableOffsets(const uint64_t (&masks)[64]) {
+    std::array<uint32_t, 65> offsets = {};
+    for(int square = 0; square < 64; square++) {
+        offsets[square + 1] = offsets[square] + (1U << std::popcount(masks[square]));
+    }
+    return offsets;
+}
+constexpr std::array<uint32_t, 65> rookOffsets = sliderTableOffsets(rookMasks);
+constexpr std::array<uint32_t, 65> bishopOffsets = sliderTableOffsets(bishopMasks);
+
+// the tables for both indexing schemes are built by the compiler (in magic.cpp) and sit in the binary,
+// so startup doesn't fill anything and every process on the machine shares the same pages
+extern const std::array<uint64_t, rookOffsets[64]> magicRookTable;
+extern const std::array<uint64_t, bishopOffsets[64]> magicBishopTable;
+extern const std::array<uint64_t, rookOffsets[64]> pextRookTable;
+extern const std::array<uint64_t, bishopOffsets[64]> pextBishopTable;
+// the compressed layout keeps each attack set pexted down to just the squares the piece could reach on an empty board, which always fits in 16 bits
+// it's only there to compare against, so it gets filled when something switches to it
+extern std::array<uint16_t, rookOffsets[64]> compressedRookTable;
+extern std::array<uint16_t, bishopOffsets[64]> compressedBishopTable;
+// the layout from before the offset tables, a whole 4096 or 512 slots for every square (2MB and 256KB)
+// only kept so sliderbench has something to compare against, so it's only allocated while that's using it
+extern std::vector<std::array<uint64_t, 4096>> flatRookTable;
+extern std::vector<std::array<uint64_t, 512>> flatBishopTable;
+
+constexpr std::array<uint64_t, 64> sliderReach(const int firstDirection) {
+    std::array<uint64_t, 64> reach = {};
+    for(int square = 0; square < 64; square++) {
+        reach[square] = rayAttacks(square, 0, firstDirection);
+    }
+    return reach;
+}
+constexpr std::array<uint64_t, 64> rookReach = sliderReach(0);
+constexpr std::array<uint64_t, 64> bishopReach = sliderReach(4);
+
+enum class SliderLayout {
+    Magic, Pext, CompressedPext, FlatMagic, FlatPext
+};
 
 uint64_t getRookAttacksFromTable(uint64_t occupiedBitboard, int square);
 uint64_t getBishopAttacksFromTable(uint64_t occupiedBitboard, int square);
 
 void generateLookups();
+
+// the index is calculated with pext where the cpu has it and it's fast, and with magics everywhere else
+// this is picked in generateLookups
+extern SliderLayout sliderLayout;
+// switches to another layout, if the cpu can do it, and gives back whether it switched
+// only between searches, since nothing else can be looking anything up while it happens
+bool setSliderLayout(SliderLayout layout);
+bool pextIsFast();
+bool pextIsSupported();
+uint64_t pextRookAttacks(uint64_t occupiedBitboard, int square);
+uint64_t pextBishopAttacks(uint64_t occupiedBitboard, int square);
+uint64_t compressedRookAttacks(uint64_t occupiedBitboard, int square);
+uint64_t compressedBishopAttacks(uint64_t occupiedBitboard, int square);
+uint64_t flatPextRookAttacks(uint64_t occupiedBitboard, int square);
+uint64_t flatPextBishopAttacks(uint64_t occupiedBitboard, int square);
+std::string_view sliderPath();
+std::string_view sliderLayoutName(SliderLayout layout);
@@ -36,3 +36,15 @@ void runPerftSuite(int number);
 int perft(Board &board, int depth);
 void splitPerft(Board board, int depth);
 void individualPerft(Board board, int depth);
+
+// checks the lazy accumulators against ones built from scratch
+void nnueCheck(Board board, int depth);
+// checks the lazily worked out threats against ones calculated from nothing
+void threatCheck(Board board, int depth);
+// times the attacked square lookups for every move at a node, one by one and from the attack map
+void attackMapBench();
+// times movegen, see and threats with each way of laying out the slider tables
+void sliderBench();
+
+// transposition table tests
+void ttStress(int threadCount, int seconds);
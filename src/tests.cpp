@@ -17,18 +17,23 @@
 */
 #include "testessentials.h"
 #include "testsuites.h"
+#include "tt.h"
+#include "bench.h"
+#include "slidey.h"
+#include "see.h"
 
 // runs a single perft test
 int perft(Board &board, int depth) {
     if(depth == 0) return 1;
     std::array<Move, 256> moves;
-    int numMoves = board.getMoves(moves);
+    const int numMoves = board.getLegalMoves(moves);
+    // every move generated is legal, so the last ply can just be counted instead of played
+    if(depth == 1) return numMoves;
     int result = 0;
     for(int i = 0; i < numMoves; i++) {
-        if(board.makeMove<false>(moves[i])) {
-            result += perft(board, depth-1);
-            board.undoMove<false>();
-        }
+        board.makeMove<false>(moves[i]);
+        result += perft(board, depth-1);
+        board.undoMove<false>();
     }
     return result;
 }
@@ -57,7 +62,7 @@ void runPerftSuite(int number) {
         clock_t end = clock();
         std::cout << "Passed " << std::to_string(passed) << ", Failed " << std::to_string(failed) << '\n';
         std::cout << "Tests took: " << std::to_string((end-start)/static_cast<double>(1000)) << '\n';
-        std::cout << "Total nodes: " << std::to_string(static_cast<int>(total)) << '\n';
+        std::cout << "Total nodes: " << std::to_string(static_cast<uint64_t>(total)) << '\n';
         std::cout << "NPS: " << std::to_string(total / ((end-start)/static_cast<double>(1000))) << '\n';
     }
 }
@@ -65,16 +70,15 @@ void runPerftSuite(int number) {
 // runs perft split by what the first move that is done is
 void splitPerft(Board board, int depth) {
     std::array<Move, 256> moves;
-    int numMoves = board.getMoves(moves);
+    int numMoves = board.getLegalMoves(moves);
     int total = 0;
     clock_t start = clock();
     for(int i = 0; i < numMoves; i++) {
-        if(board.makeMove<false>(moves[i])) {
-            int result = perft(board, depth - 1);
-            board.undoMove<false>();
-            total += result;
-            std::cout << toLongAlgebraic(moves[i]) << ": " << std::to_string(result) << '\n';
-        }
+        board.makeMove<false>(moves[i]);
+        int result = perft(board, depth - 1);
+        board.undoMove<false>();
+        total += result;
+        std::cout << toLongAlgebraic(moves[i]) << ": " << std::to_string(result) << '\n';
     }
     clock_t end = clock();
     std::cout << "Total: " << std::to_string(total) << '\n';
@@ -90,4 +94,294 @@ void individualPerft(Board board, int depth) {
     std::cout << "Result: " << std::to_string(result) << '\n';
     std::cout << "Time: " << std::to_string((end-start)/static_cast<double>(1000)) << '\n';
     std::cout << "NPS: " << std::to_string(result / ((end-start)/static_cast<double>(1000))) << '\n';
-}
\ No newline at end of file
+}
+// walks the whole tree, with null moves mixed in, and only evaluates some of the nodes so that the updates pile up between evaluations
+void nnueCheckNode(Board &board, int depth, uint64_t &checked, uint64_t &mismatches) {
+    // evaluating every node would materialize everything right away, which wouldn't test much
+    if(depth == 0 || board.getZobristHash() % 3 == 0) {
+        const auto [incremental, scratch] = board.checkEvaluation();
+        checked++;
+        if(incremental != scratch) {
+            if(mismatches == 0) std::cout << "first mismatch: " << board.getFenString() << " incremental " << incremental << " scratch " << scratch << '\n';
+            mismatches++;
+        }
+    }
+    if(depth == 0) return;
+    if(!board.isInCheck() && board.getZobristHash() % 5 == 0) {
+        board.changeColor();
+        nnueCheckNode(board, depth - 1, checked, mismatches);
+        board.undoChangeColor();
+    }
+    std::array<Move, 256> moves;
+    const int numMoves = board.getMoves(moves);
+    for(int i = 0; i < numMoves; i++) {
+        if(board.makeMove<true>(moves[i])) {
+            nnueCheckNode(board, depth - 1, checked, mismatches);
+            board.undoMove<true>();
+        }
+    }
+}
+
+void nnueCheck(Board board, int depth) {
+    uint64_t checked = 0;
+    uint64_t mismatches = 0;
+    nnueCheckNode(board, depth, checked, mismatches);
+    std::cout << "Evaluations checked: " << checked << ", mismatches: " << mismatches << '\n';
+}
+
+// walks the whole tree like nnueCheck, checking the lazily worked out threats against calculateThreats, and the one square check
+// against both, and that whatever was cached at a node is still right once the moves under it have been undone
+// it also checks that isLegal, which the move picker trusts, agrees with making each move and looking for the check
+void threatCheckNode(Board &board, int depth, uint64_t &checked, uint64_t &mismatches) {
+    const bool inCheck = board.isInCheck();
+    const uint64_t expected = board.calculateThreats();
+    const uint64_t king = board.getColoredPieceBitboard(board.getColorToMove(), King);
+    // only some of the nodes ask for their threats, so that the children of ones that didn't get checked too
+    const bool asked = board.getZobristHash() % 3 == 0;
+    const auto check = [&](bool matches) {
+        checked++;
+        if(!matches) {
+            if(mismatches == 0) std::cout << "first mismatch: " << board.getFenString() << '\n';
+            mismatches++;
+        }
+    };
+    check(inCheck == ((expected & king) != 0));
+    if(asked) {
+        check(board.getThreats() == expected);
+    }
+    if(depth > 0) {
+        if(!inCheck && board.getZobristHash() % 5 == 0) {
+            board.changeColor();
+            threatCheckNode(board, depth - 1, checked, mismatches);
+            board.undoChangeColor();
+        }
+        std::array<Move, 256> moves;
+        const int numMoves = board.getMoves(moves);
+        const uint64_t pinned = board.getPinned();
+        const uint64_t checkers = board.getCheckers();
+        for(int i = 0; i < numMoves; i++) {
+            const bool legal = board.isLegal(moves[i], pinned, checkers);
+            const bool played = board.makeMove<false>(moves[i]);
+            if(played) {
+                threatCheckNode(board, depth - 1, checked, mismatches);
+                board.undoMove<false>();
+            }
+            check(legal == played);
+        }
+    }
+    check(board.getThreats() == expected && board.isInCheck() == inCheck);
+}
+
+void threatCheck(Board board, int depth) {
+    uint64_t checked = 0;
+    uint64_t mismatches = 0;
+    threatCheckNode(board, depth, checked, mismatches);
+    std::cout << "Threats checked: " << checked << ", mismatches: " << mismatches << '\n';
+}
+
+// every position a couple of plies out from the bench positions, with its moves, for attackMapBench
+struct AttackBenchNode {
+    Board board;
+    std::array<Move, 256> moves;
+    int count;
+};
+
+void collectAttackBenchNodes(Board &board, int depth, std::vector<AttackBenchNode> &nodes) {
+    AttackBenchNode &node = nodes.emplace_back(AttackBenchNode{board, {}, 0});
+    node.count = board.getMoves(node.moves);
+    if(depth == 0) return;
+    std::array<Move, 256> moves = node.moves;
+    const int count = node.count;
+    for(int i = 0; i < count; i++) {
+        if(board.makeMove<false>(moves[i])) {
+            collectAttackBenchNodes(board, depth - 1, nodes);
+            board.undoMove<false>();
+        }
+    }
+}
+
+// what the history indices cost at a node, asking the board about each move's start and end square vs looking both up in the node's attack map
+void attackMapBench() {
+    constexpr int passes = 50;
+    std::vector<AttackBenchNode> nodes;
+    for(const auto &fen : benchFens) {
+        Board board(fen);
+        collectAttackBenchNodes(board, 1, nodes);
+    }
+    // the threats get cached the first time, which both ways would do at a real node, so that's left out of the timing
+    for(auto &node : nodes) {
+        static_cast<void>(node.board.getThreats());
+    }
+
+    volatile uint64_t sink = 0;
+    const auto time = [&](auto attackedCount) {
+        const auto begin = std::chrono::steady_clock::now();
+        for(int pass = 0; pass < passes; pass++) {
+            for(const auto &node : nodes) {
+                sink = sink + attackedCount(node);
+            }
+        }
+        const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+        return double(elapsed) / (double(passes) * nodes.size());
+    };
+    const double perSquare = time([](const AttackBenchNode &node) {
+        uint64_t attacked = 0;
+        for(int i = 0; i < node.count; i++) {
+            attacked += node.board.squareIsUnderAttack(node.moves[i].getStartSquare()) + node.board.squareIsUnderAttack(node.moves[i].getEndSquare());
+        }
+        return attacked;
+    });
+    const double attackMap = time([](const AttackBenchNode &node) {
+        const uint64_t threats = node.board.getThreats();
+        uint64_t attacked = 0;
+        for(int i = 0; i < node.count; i++) {
+            attacked += ((threats >> node.moves[i].getStartSquare()) & 1) + ((threats >> node.moves[i].getEndSquare()) & 1);
+        }
+        return attacked;
+    });
+    std::cout << nodes.size() << " nodes, attacked squares for every move (ns per node): " << perSquare << " asking the board vs " << attackMap << " from the attack map\n";
+}
+
+// the three things that lean on the slider tables hardest, under each layout the cpu can do, old and new
+void sliderBench() {
+    constexpr int passes = 20;
+    std::vector<AttackBenchNode> nodes;
+    for(const auto &fen : benchFens) {
+        Board board(fen);
+        collectAttackBenchNodes(board, 1, nodes);
+    }
+
+    volatile uint64_t sink = 0;
+    const auto time = [&](auto work) {
+        const auto begin = std::chrono::steady_clock::now();
+        for(int pass = 0; pass < passes; pass++) {
+            for(const auto &node : nodes) {
+                sink = sink + work(node);
+            }
+        }
+        const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+        return double(elapsed) / (double(passes) * nodes.size());
+    };
+
+    const SliderLayout original = sliderLayout;
+    std::cout << nodes.size() << " nodes, ns per node for movegen, see on every move, and threats\n";
+    std::cout << "rook table " << rookOffsets[64] * sizeof(uint64_t) / 1024 << "KB, bishop table " << bishopOffsets[64] * sizeof(uint64_t) / 1024
+        << "KB, or " << rookOffsets[64] * sizeof(uint16_t) / 1024 << "KB and " << bishopOffsets[64] * sizeof(uint16_t) / 1024 << "KB compressed, "
+        << 64 * sizeof(flatRookTable[0]) / 1024 << "KB and " << 64 * sizeof(flatBishopTable[0]) / 1024 << "KB flat\n";
+    // the flat ones are how the tables were laid out before, so there's a before and after on the same machine
+    for(const SliderLayout layout : {SliderLayout::FlatMagic, SliderLayout::Magic, SliderLayout::FlatPext, SliderLayout::Pext, SliderLayout::CompressedPext}) {
+        if(!setSliderLayout(layout)) {
+            std::cout << sliderLayoutName(layout) << ": not supported on this cpu\n";
+            continue;
+        }
+        const double movegen = time([](const AttackBenchNode &node) {
+            std::array<Move, 256> moves;
+            return node.board.getMoves(moves);
+        });
+        const double exchanges = time([](const AttackBenchNode &node) {
+            uint64_t winning = 0;
+            for(int i = 0; i < node.count; i++) {
+                winning += see(node.board, node.moves[i], 0);
+            }
+            return winning;
+        });
+        const double threats = time([](const AttackBenchNode &node) {
+            return node.board.calculateThreats();
+        });
+        std::cout << sliderLayoutName(layout) << ": movegen " << movegen << ", see " << exchanges << ", threats " << threats << '\n';
+    }
+    setSliderLayout(original);
+}
+
+// what the stress test writes for a key, so that a reader can tell if the data it got back belongs to that key
+Transposition stressEntry(uint64_t key) {
+    return Transposition(std::bit_cast<Move>(static_cast<uint16_t>(key >> 24)), 1 + key % 3, static_cast<int16_t>(key >> 32), static_cast<int16_t>(key >> 16), (key >> 40) & 0xFF);
+}
+
+// the age gets stamped by the table, so it's left out
+bool sameEntry(const Transposition &a, const Transposition &b) {
+    return a.score == b.score && a.bestMove == b.bestMove && a.staticEval == b.staticEval && a.flag == b.flag && a.depth == b.depth;
+}
+
+// hammers a small table from a bunch of threads at once, all fighting over the same few clusters,
+// and counts torn entries that the key check caught and ones that got through it
+void ttStress(int threadCount, int seconds) {
+    constexpr int clusterCount = 4;
+    constexpr int keysPerCluster = 64;
+    TranspositionTable table(1);
+    // every key has different low 16 bits, so a raw key word can be traced back to the key it was written for
+    std::vector<uint64_t> keys;
+    std::array<int, 65536> keyFromLow;
+    keyFromLow.fill(-1);
+    std::mt19937_64 rng(0xC1A);
+    for(int c = 0; c < clusterCount; c++) {
+        for(int i = 0; i < keysPerCluster; i++) {
+            // the top bits pick the cluster
+            const uint64_t low = (rng() & 0x0000FFFFFFFF0000ULL) | static_cast<uint64_t>(keys.size() + 1);
+            keyFromLow[shrink(low)] = keys.size();
+            keys.push_back((static_cast<uint64_t>(c) << 62) | low);
+        }
+    }
+
+    std::atomic<uint64_t> writes = 0;
+    std::atomic<uint64_t> probes = 0;
+    std::atomic<uint64_t> hits = 0;
+    std::atomic<uint64_t> slotsChecked = 0;
+    std::atomic<uint64_t> detected = 0;
+    std::atomic<uint64_t> undetected = 0;
+    std::atomic<bool> stop = false;
+
+    std::vector<std::thread> threads;
+    for(int t = 0; t < threadCount; t++) {
+        threads.emplace_back([&, t]() {
+            std::mt19937_64 threadRng(t);
+            uint64_t localWrites = 0, localProbes = 0, localHits = 0, localSlots = 0, localDetected = 0, localUndetected = 0;
+            while(!stop.load(std::memory_order_relaxed)) {
+                for(int i = 0; i < 1024; i++) {
+                    const uint64_t key = keys[threadRng() % keys.size()];
+                    Transposition entry = stressEntry(key);
+                    table.setEntry(key, entry);
+                    localWrites++;
+
+                    const uint64_t probeKey = keys[threadRng() % keys.size()];
+                    localProbes++;
+                    if(table.probe(probeKey, entry)) {
+                        localHits++;
+                        if(!sameEntry(entry, stressEntry(probeKey))) localUndetected++;
+                    }
+
+                    // read the raw words of a slot the same way a probe does, and see if they still belong together
+                    const TTCluster &cluster = table.getCluster(probeKey);
+                    const int slot = threadRng() % entriesPerCluster;
+                    const uint64_t data = __atomic_load_n(&cluster.data[slot], __ATOMIC_RELAXED);
+                    const uint16_t keyWord = __atomic_load_n(&cluster.keys[slot], __ATOMIC_RELAXED);
+                    if(data == 0 && keyWord == 0) continue;
+                    localSlots++;
+                    const int owner = keyFromLow[keyWord ^ foldData(data)];
+                    if(owner == -1) {
+                        localDetected++;
+                    } else if(!sameEntry(unpackEntry(data), stressEntry(keys[owner]))) {
+                        localUndetected++;
+                    }
+                }
+            }
+            writes += localWrites;
+            probes += localProbes;
+            hits += localHits;
+            slotsChecked += localSlots;
+            detected += localDetected;
+            undetected += localUndetected;
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    stop.store(true);
+    for(auto &thread : threads) {
+        thread.join();
+    }
+
+    std::cout << "Threads: " << threadCount << ", time: " << seconds << "s\n";
+    std::cout << "Writes: " << writes << ", probes: " << probes << ", hits: " << hits << '\n';
+    std::cout << "Raw slots checked: " << slotsChecked << '\n';
+    std::cout << "Torn entries caught by the key check: " << detected << '\n';
+    std::cout << "Corrupted entries that got through: " << undetected << '\n';
+}
@@ -24,33 +24,231 @@ uint64_t index(uint64_t key, size_t size) {
     return static_cast<uint64_t>((static_cast<unsigned __int128>(key) * static_cast<unsigned __int128>(size)) >> 64);
 }
 
-Transposition* TranspositionTable::getEntry(uint64_t zkey) {
-    return &table[index(zkey, size)];
+// relaxed is enough here, the key check is what catches entries that another thread was halfway through writing
+template <typename T>
+T loadWord(const T &word) {
+    return __atomic_load_n(&word, __ATOMIC_RELAXED);
 }
 
-void TranspositionTable::setEntry(uint64_t zkey, Transposition &entry) {
-    table[index(zkey, size)] = entry;
+template <typename T>
+void storeWord(T &word, T value) {
+    __atomic_store_n(&word, value, __ATOMIC_RELAXED);
+}
+
+int TranspositionTable::relativeAge(uint8_t entryAge) const {
+    return (ageCycle + age - entryAge) % ageCycle;
+}
+
+size_t TranspositionTable::clusterIndex(uint64_t zkey) const {
+    return flat ? index(zkey, size * entriesPerCluster) / entriesPerCluster : index(zkey, size);
+}
+
+const TTCluster &TranspositionTable::getCluster(uint64_t zkey) const {
+    return table[clusterIndex(zkey)];
+}
+
+// gives back the slot with a matching key if there is one, otherwise the slot that would get replaced
+int TranspositionTable::findSlot(uint64_t zkey, const TTCluster &cluster, bool &found) const {
+    if(flat) {
+        const int slot = index(zkey, size * entriesPerCluster) % entriesPerCluster;
+        found = loadWord(cluster.keys[slot]) == encodeKey(zkey, loadWord(cluster.data[slot]));
+        return slot;
+    }
+    int replace = 0;
+    int replaceValue = INT32_MAX;
+    for(int i = 0; i < entriesPerCluster; i++) {
+        const uint64_t data = loadWord(cluster.data[i]);
+        if(loadWord(cluster.keys[i]) == encodeKey(zkey, data)) {
+            found = true;
+            return i;
+        }
+        // shallow entries from old searches are the first to go
+        const Transposition entry = unpackEntry(data);
+        const int value = entry.depth - 8 * relativeAge(entry.age);
+        if(value < replaceValue) {
+            replace = i;
+            replaceValue = value;
+        }
+    }
+    found = false;
+    return replace;
+}
+
+bool TranspositionTable::probe(uint64_t zkey, Transposition &entry) const {
+    const TTCluster &cluster = table[clusterIndex(zkey)];
+    const int start = flat ? index(zkey, size * entriesPerCluster) % entriesPerCluster : 0;
+    const int end = flat ? start + 1 : entriesPerCluster;
+    for(int i = start; i < end; i++) {
+        // the data is only read once, so the key check and the entry given back always agree
+        const uint64_t data = loadWord(cluster.data[i]);
+        if(loadWord(cluster.keys[i]) == encodeKey(zkey, data)) {
+            entry = unpackEntry(data);
+            return true;
+        }
+    }
+    entry = Transposition();
+    return false;
+}
+
+void TranspositionTable::setEntry(uint64_t zkey, Transposition &entry, [[maybe_unused]] TTStats *stats) {
+    TTCluster &cluster = table[clusterIndex(zkey)];
+    bool found;
+    const int slot = findSlot(zkey, cluster, found);
+    const uint64_t oldData = loadWord(cluster.data[slot]);
+    const Transposition old = unpackEntry(oldData);
+    const bool empty = oldData == 0 && loadWord(cluster.keys[slot]) == 0;
+    // an entry with nothing but a static eval only goes into an empty slot, it isn't worth pushing anything out for
+    // and don't let a shallow search of the same position overwrite a deeper one from this search
+    if((entry.flag == Undefined && !empty) || (!flat && found && entry.flag != Exact && entry.depth + 4 <= old.depth && old.age == age)) {
+#ifdef TT_STATS_ENABLED
+        if(stats) stats->add(SkippedWrites);
+#endif
+        return;
+    }
+#ifdef TT_STATS_ENABLED
+    if(stats) {
+        if(found) {
+            stats->add(SameKeyWrites);
+        } else if(empty) {
+            stats->add(EmptyWrites);
+        } else {
+            stats->add(old.depth == 0 ? EvictDepth0 : old.depth < 8 ? EvictDepth1To7 : EvictDepth8Plus);
+        }
+    }
+#endif
+    entry.age = age;
+    const uint64_t data = packEntry(entry);
+    storeWord(cluster.data[slot], data);
+    storeWord(cluster.keys[slot], encodeKey(zkey, data));
+}
+
+void TranspositionTable::prefetch(uint64_t zkey) const {
+    __builtin_prefetch(&table[clusterIndex(zkey)]);
+}
+
+int TranspositionTable::hashfull() const {
+    const size_t sample = std::min<size_t>(1000, size);
+    int used = 0;
+    for(size_t i = 0; i < sample; i++) {
+        for(int j = 0; j < entriesPerCluster; j++) {
+            const uint64_t data = loadWord(table[i].data[j]);
+            if((data != 0 || loadWord(table[i].keys[j]) != 0) && unpackEntry(data).age == age) used++;
+        }
+    }
+    return used * 1000 / (sample * entriesPerCluster);
+}
+
+// called once at the start of each search, so that entries from past searches can be told apart
+void TranspositionTable::incrementAge() {
+    age = (age + 1) % ageCycle;
 }
 
 void TranspositionTable::clearTable(int threadCount) {
+    startClear(threadCount);
+    waitForClear();
+}
+
+void TranspositionTable::startClear(int threadCount) {
+    waitForClear();
+    age = 0;
     const std::size_t chunks = (size + threadCount - 1) / threadCount;
-    std::vector<std::thread> threads;
     for(int i = 0; i < threadCount; ++i) {
-        threads.emplace_back([i, chunks, this]() {
+        clearThreads.emplace_back([i, chunks, this]() {
             const std::size_t clearIndex = chunks * i;
-            const std::size_t clearSize = std::min(chunks, size - clearIndex) * sizeof(Transposition);
+            if(clearIndex >= size) return;
+            const std::size_t clearSize = std::min(chunks, size - clearIndex) * sizeof(TTCluster);
             std::memset(table.data() + clearIndex, 0, clearSize);
         });
     }
-    for(auto &thread : threads) {
+}
+
+void TranspositionTable::waitForClear() {
+    for(auto &thread : clearThreads) {
         thread.join();
     }
+    clearThreads.clear();
 }
 
 void TranspositionTable::resize(size_t newSizeMB, int threadCount) {
+    waitForClear();
     size_t newSizeB = newSizeMB * 1024 * 1024;
-    size_t newSizeEntries = newSizeB / sizeof(Transposition);
-    size = newSizeEntries;
-    table.resize(size, Transposition());
+    size_t newSizeClusters = newSizeB / sizeof(TTCluster);
+    size = newSizeClusters;
+    table.allocate(size);
+    // the memory comes back zeroed already, but clearing it touches every page now, split over one short lived thread per search thread, rather than one at a time during the search
+    // those threads aren't pinned anywhere, so this does nothing about which NUMA node the pages end up on
     clearTable(threadCount);
 }
+
+bool TranspositionTable::save(const std::string &path) {
+    waitForClear();
+    TTFileHeader header{};
+    header.magic = ttFileMagic;
+    header.version = ttFileVersion;
+    header.age = age;
+    header.clusterCount = size;
+    header.networkHash = networkHash();
+    std::array<char, ttFileHeaderSize> headerPage{};
+    std::memcpy(headerPage.data(), &header, sizeof(header));
+
+    // written somewhere else first and then moved over, since the table might currently be mapped from this same file
+    const std::string tempPath = path + ".tmp";
+    std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+    file.write(headerPage.data(), headerPage.size());
+    file.write(reinterpret_cast<const char *>(table.data()), table.bytes());
+    file.close();
+    if(!file) {
+        std::cout << "failed to write " << tempPath << '\n';
+        std::remove(tempPath.c_str());
+        return false;
+    }
+    if(std::rename(tempPath.c_str(), path.c_str()) != 0) {
+        std::cout << "failed to move " << tempPath << " to " << path << '\n';
+        return false;
+    }
+    return true;
+}
+
+bool TranspositionTable::load(const std::string &path) {
+    waitForClear();
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if(!file) {
+        std::cout << "couldn't open " << path << '\n';
+        return false;
+    }
+    const size_t fileSize = file.tellg();
+    TTFileHeader header;
+    file.seekg(0);
+    if(fileSize < ttFileHeaderSize || !file.read(reinterpret_cast<char *>(&header), sizeof(header))) {
+        std::cout << path << " is too small to be a saved hash table\n";
+        return false;
+    }
+    if(header.magic != ttFileMagic) {
+        std::cout << path << " isn't a saved hash table\n";
+        return false;
+    }
+    if(header.version != ttFileVersion) {
+        std::cout << path << " was saved by a different version (" << header.version << ", expected " << ttFileVersion << ")\n";
+        return false;
+    }
+    if(header.networkHash != networkHash()) {
+        std::cout << path << " was saved with a different network\n";
+        return false;
+    }
+    if(header.clusterCount != size) {
+        std::cout << path << " was saved with Hash " << header.clusterCount * sizeof(TTCluster) / (1024 * 1024) << ", set that first\n";
+        return false;
+    }
+    if(fileSize < ttFileHeaderSize + size * sizeof(TTCluster)) {
+        std::cout << path << " is cut off\n";
+        return false;
+    }
+    LargeAllocation mapped = mapFile(path, ttFileHeaderSize, size * sizeof(TTCluster));
+    if(mapped.ptr == nullptr) {
+        std::cout << "failed to map " << path << '\n';
+        return false;
+    }
+    table.adopt(mapped, size);
+    age = header.age;
+    return true;
+}
@@ -18,6 +18,7 @@
 #pragma once
 
 #include "globals.h"
+#include "largepages.h"
 
 /*
     Transposition Table:
@@ -32,43 +33,147 @@ constexpr uint16_t shrink(uint64_t hash) {
 // this gives me a 64mb hash table
 constexpr uint64_t defaultSize = 64;
 
-#pragma pack(push, 1)
+// 6 entries of 10 bytes fit in a single cache line, with 4 bytes to spare
+constexpr int entriesPerCluster = 6;
+// the age wraps around after this many searches, since it only gets 6 bits
+constexpr int ageCycle = 64;
+
+// an entry as the search sees it, unpacked from the table
 struct Transposition {
     int16_t score;
     Move bestMove;
-    uint16_t zobristKey;
     int16_t staticEval;
     uint8_t flag;
+    uint8_t age;
     uint8_t depth;
     Transposition() {
-        zobristKey = 0;
         bestMove = Move();
         flag = 0;
+        age = 0;
         score = 0;
         depth = 0;
         staticEval = 0;
     }
-    Transposition(uint64_t _zobristKey, Move _bestMove, uint8_t _flag, int _staticEval, int _score, uint8_t _depth) {
-        zobristKey = shrink(_zobristKey);
+    Transposition(Move _bestMove, uint8_t _flag, int _staticEval, int _score, uint8_t _depth) {
         bestMove = _bestMove;
         flag = _flag;
+        age = 0;
         score = _score;
         depth = _depth;
         staticEval = _staticEval;
     }
 };
-#pragma pack(pop)
+
+/*
+    entries are stored as one 64 bit data word and one 16 bit key word, each read and written atomically,
+    the key word is xored with the data so that if another thread writes the slot between the two reads,
+    the key won't match and it counts as a miss instead of giving back another position's data
+*/
+struct alignas(64) TTCluster {
+    std::array<uint64_t, entriesPerCluster> data;
+    std::array<uint16_t, entriesPerCluster> keys;
+};
+
+static_assert(sizeof(TTCluster) == 64);
+
+// data word layout: score (16) | move (16) | static eval (16) | depth (8) | flag (2) | age (6)
+inline uint64_t packEntry(const Transposition &entry) {
+    return static_cast<uint64_t>(static_cast<uint16_t>(entry.score))
+        | static_cast<uint64_t>(std::bit_cast<uint16_t>(entry.bestMove)) << 16
+        | static_cast<uint64_t>(static_cast<uint16_t>(entry.staticEval)) << 32
+        | static_cast<uint64_t>(entry.depth) << 48
+        | static_cast<uint64_t>(entry.flag & 3) << 56
+        | static_cast<uint64_t>(entry.age & 63) << 58;
+}
+
+inline Transposition unpackEntry(uint64_t data) {
+    Transposition entry;
+    entry.score = static_cast<int16_t>(data & 0xFFFF);
+    entry.bestMove = std::bit_cast<Move>(static_cast<uint16_t>((data >> 16) & 0xFFFF));
+    entry.staticEval = static_cast<int16_t>((data >> 32) & 0xFFFF);
+    entry.depth = (data >> 48) & 0xFF;
+    entry.flag = (data >> 56) & 3;
+    entry.age = (data >> 58) & 63;
+    return entry;
+}
+
+// folds the data word down to 16 bits, for xoring with the key
+constexpr uint16_t foldData(uint64_t data) {
+    return (data ^ (data >> 16) ^ (data >> 32) ^ (data >> 48)) & 0xFFFF;
+}
+
+constexpr uint16_t encodeKey(uint64_t zkey, uint64_t data) {
+    return shrink(zkey) ^ foldData(data);
+}
+
+// the counters cost a bit of speed, so release builds only have them if TT_STATS is defined
+#if !defined(NDEBUG) || defined(TT_STATS)
+#define TT_STATS_ENABLED
+#endif
+
+enum TTStat {
+    Probes, Hits, Cutoffs, MainWrites, QSWrites, SkippedWrites, EmptyWrites, SameKeyWrites, EvictDepth0, EvictDepth1To7, EvictDepth8Plus, TTStatCount
+};
+
+// each thread gets its own set, on its own cache lines so that threads don't fight over them
+struct alignas(64) TTStats {
+    std::array<uint64_t, TTStatCount> counts{};
+    void add([[maybe_unused]] TTStat stat) {
+#ifdef TT_STATS_ENABLED
+        counts[stat]++;
+#endif
+    }
+};
+
+// saved tables start with this, and it gets its own page so that the clusters after it can be mapped straight from the file
+struct TTFileHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint8_t age;
+    // spelled out so that it gets zeroed, and saving the same table twice gives the same file
+    std::array<uint8_t, 3> padding;
+    uint64_t clusterCount;
+    uint64_t networkHash;
+};
+
+constexpr uint64_t ttFileMagic = 0x5454595449524C43ULL; // "CLRITYTT"
+constexpr uint32_t ttFileVersion = 1;
+constexpr size_t ttFileHeaderSize = 4096;
+static_assert(std::has_unique_object_representations_v<TTFileHeader>, "the header can't have any padding the compiler adds");
 
 struct TranspositionTable {
     public:
-        Transposition* getEntry(uint64_t zkey);
-        void setEntry(uint64_t zkey, Transposition &entry);
+        bool probe(uint64_t zkey, Transposition &entry) const;
+        void setEntry(uint64_t zkey, Transposition &entry, TTStats *stats = nullptr);
+        void prefetch(uint64_t zkey) const;
+        void incrementAge();
+        // permill of a sample of the table that was written during this search
+        int hashfull() const;
         void clearTable(int numThreads);
+        // clears in the background, anything that touches the table has to wait for it to finish first
+        void startClear(int numThreads);
+        void waitForClear();
         void resize(size_t newSizeMB, int threadCount);
+        // both of these print what went wrong if they fail
+        bool save(const std::string &path);
+        bool load(const std::string &path);
+        // raw access, only for the stress test
+        const TTCluster &getCluster(uint64_t zkey) const;
+        PageBacking backing() const {
+            return table.backing();
+        }
         TranspositionTable(uint64_t initSize = defaultSize) {
             resize(initSize, 1);
         }
+        // number of clusters
         size_t size;
+        // makes the table act like the old one (every entry is its own slot and always gets replaced), only used by ttbench
+        bool flat = false;
     private:
-        std::vector<Transposition> table;
-};
\ No newline at end of file
+        uint8_t age = 0;
+        LargeArray<TTCluster> table;
+        std::vector<std::jthread> clearThreads;
+        int relativeAge(uint8_t entryAge) const;
+        int findSlot(uint64_t zkey, const TTCluster &cluster, bool &found) const;
+        size_t clusterIndex(uint64_t zkey) const;
+};
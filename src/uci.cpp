@@ -24,6 +24,8 @@
 #include "uci.h"
 #include "tunables.h"
 #include "eval.h"
+#include "kernels.h"
+#include "slidey.h"
 
 bool useSyzygy = false;
 
@@ -32,6 +34,11 @@ bool useSyzygy = false;
     There are things not supported here though, such as go infinite, and quite a few options
 */
 
+// when startup began, stamped before any other global gets made so that copying the network onto huge pages is counted,
+// and when main got through each part of it, for startuptime
+__attribute__((init_priority(101))) const std::chrono::steady_clock::time_point processStart = std::chrono::steady_clock::now();
+std::array<std::chrono::steady_clock::time_point, 3> startupStamps;
+
 int defaultMovesToGo = 20;
 
 Board board("8/8/8/8/8/8/8/8 w - - 0 1");
@@ -40,23 +47,56 @@ std::vector<Engine> engines;
 std::vector<std::jthread> threads;
 int threadCount = 1;
 int64_t moveOverhead = 10;
+// per thread, in MB
+size_t evalCacheSize = EvalCache::defaultSizeMB;
 
 int rootColorToMove;
 
-// resets everything
-void newGame() {
-    engines.clear();
+// waits for all of the background clearing to be done
+void waitForClears() {
+    TT.waitForClear();
+    for(const auto &engine : engines) {
+        engine.waitForReset();
+    }
+}
+
+// makes it one engine per thread, keeping the ones that are already there, and gives back how many were kept
+int resizePool() {
+    const int kept = std::min<int>(engines.size(), threadCount);
+    if(std::ssize(engines) == threadCount) return kept;
+    // the engines might move around, so nothing can still be resetting them
+    waitForClears();
+    engines.erase(engines.begin() + kept, engines.end());
     engines.reserve(threadCount);
-    for(int i = 0; i < threadCount; i++) {
+    while(std::ssize(engines) < threadCount) {
         engines.emplace_back(&TT);
-        engines[i].resetEngine();
+        engines.back().evalCache.resize(evalCacheSize);
     }
-    TT.clearTable(threadCount);
+    return kept;
+}
+
+// resets everything, the engines and the TT get cleared in the background and go waits for them
+void newGame() {
+    resizePool();
+    for(auto &engine : engines) {
+        engine.startReset();
+    }
+    TT.startClear(threadCount);
     board = Board("8/8/8/8/8/8/8/8 w - - 0 1");
 }
 
+// how long each part of startup took, everything before the first command is read
+void printStartupTime() {
+    const auto micros = [](const auto from, const auto to) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(to - from).count();
+    };
+    std::cout << "globals " << micros(processStart, startupStamps[0]) << "us, initialize " << micros(startupStamps[0], startupStamps[1])
+        << "us, new game " << micros(startupStamps[1], startupStamps[2]) << "us, ready for commands after " << micros(processStart, startupStamps[2]) << "us\n";
+}
+
 // runs a fixed depth search on a fixed set of positions, to see if a test changes how the engine behaves
 void runBench(int depth) {
+    std::cout << "using " << kernels->name << " kernels and " << sliderPath() << " sliders\n";
     engines[0].resetEngine();
     uint64_t total = 0;
     std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
@@ -66,9 +106,102 @@ void runBench(int depth) {
         total += j;
     }
     const auto elapsedTime = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin).count();
+    const EvalCache &cache = engines[0].evalCache;
+    std::cout << "eval cache: " << (cache.probes == 0 ? 0 : cache.hits * 100 / cache.probes) << "% hits of " << cache.probes << " probes\n";
     std::cout << total << " nodes " << std::to_string(int(total / (double(elapsedTime) / 1000))) << " nps" << '\n';
 }
 
+// runs bench with the old flat table and then with the bucketed one, and shows the time each position took to reach the depth side by side
+void runTTBench(int depth) {
+    std::array<std::vector<int64_t>, 2> times;
+    std::array<uint64_t, 2> totalNodes = {0, 0};
+    for(int mode = 0; mode < 2; mode++) {
+        TT.flat = mode == 0;
+        TT.clearTable(threadCount);
+        engines[0].resetEngine();
+        for(std::string fen : benchFens) {
+            Board benchBoard(fen);
+            std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+            totalNodes[mode] += engines[0].benchSearch(benchBoard, depth);
+            times[mode].push_back(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin).count());
+        }
+    }
+    TT.flat = false;
+    TT.clearTable(threadCount);
+    engines[0].resetEngine();
+
+    std::array<int64_t, 2> totalTimes = {0, 0};
+    std::cout << "time to depth " << depth << " (ms), old table vs bucketed table\n";
+    for(int i = 0; i < std::ssize(benchFens); i++) {
+        std::cout << "position " << (i + 1) << ": " << times[0][i] << " vs " << times[1][i] << '\n';
+        totalTimes[0] += times[0][i];
+        totalTimes[1] += times[1][i];
+    }
+    std::cout << "total: " << totalTimes[0] << " vs " << totalTimes[1] << '\n';
+    std::cout << "nodes: " << totalNodes[0] << " vs " << totalNodes[1] << '\n';
+}
+
+// runs bench with the feature weights as int16 and then as int8, the nodes should match and only the speed should change
+void runWeightsBench(int depth) {
+    const bool wasCompact = compactWeightsInUse();
+    std::array<uint64_t, 2> totalNodes = {0, 0};
+    std::array<int64_t, 2> times = {0, 0};
+    for(int mode = 0; mode < 2; mode++) {
+        if(setCompactWeights(mode == 1) != (mode == 1)) {
+            std::cout << "the feature weights of " << networkName() << " don't fit in int8\n";
+            break;
+        }
+        TT.clearTable(threadCount);
+        engines[0].resetEngine();
+        const auto begin = std::chrono::steady_clock::now();
+        for(std::string fen : benchFens) {
+            Board benchBoard(fen);
+            totalNodes[mode] += engines[0].benchSearch(benchBoard, depth);
+        }
+        times[mode] = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin).count();
+        std::cout << (mode == 0 ? "int16" : "int8") << " feature weights: " << totalNodes[mode] << " nodes " << int(totalNodes[mode] / (double(times[mode]) / 1000)) << " nps\n";
+    }
+    setCompactWeights(wasCompact);
+    TT.clearTable(threadCount);
+    engines[0].resetEngine();
+}
+
+// shows the transposition table counters from every thread added together, since the last ucinewgame
+void printTTStats() {
+#ifdef TT_STATS_ENABLED
+    TTStats total;
+    for(const auto &engine : engines) {
+        for(int i = 0; i < TTStatCount; i++) {
+            total.counts[i] += engine.ttStats.counts[i];
+        }
+    }
+    const auto percent = [](uint64_t part, uint64_t whole) {
+        return std::to_string(whole == 0 ? 0 : part * 100 / whole) + "%";
+    };
+    const auto &c = total.counts;
+    std::cout << "probes: " << c[Probes] << '\n';
+    std::cout << "hits: " << c[Hits] << " (" << percent(c[Hits], c[Probes]) << " of probes)\n";
+    std::cout << "usable cutoffs: " << c[Cutoffs] << " (" << percent(c[Cutoffs], c[Hits]) << " of hits)\n";
+    std::cout << "writes: " << c[MainWrites] << " from the main search, " << c[QSWrites] << " from qsearch\n";
+    std::cout << "skipped because a deeper entry was there: " << c[SkippedWrites] << '\n';
+    std::cout << "into empty slots: " << c[EmptyWrites] << '\n';
+    std::cout << "over the same position: " << c[SameKeyWrites] << '\n';
+    std::cout << "evicted entries by depth: 0: " << c[EvictDepth0] << ", 1-7: " << c[EvictDepth1To7] << ", 8+: " << c[EvictDepth8Plus] << '\n';
+#else
+    std::cout << "tt stats aren't in this build, build with -DTT_STATS to get them\n";
+#endif
+    std::cout << "hashfull: " << TT.hashfull() << '\n';
+}
+
+// says which kind of pages each of the big tables actually ended up on
+void printMemoryInfo() {
+    std::cout << "transposition table: " << backingName(TT.backing()) << '\n';
+    std::cout << "network: " << networkName() << ", " << networkBacking() << ", " << (compactWeightsInUse() ? "int8" : "int16") << " feature weights\n";
+    for(int i = 0; i < std::ssize(engines); i++) {
+        std::cout << "thread " << i << " history tables: " << backingName(engines[i].historyBacking()) << '\n';
+    }
+}
+
 // sets options, though currently just the hash size
 void setOption(const std::vector<std::string>& bits) {
     std::string name = bits[2];
@@ -78,14 +211,35 @@ void setOption(const std::vector<std::string>& bits) {
     } else if(name == "Threads") {
         //clock_t start = clock();
         threadCount = std::stoi(bits[4]);
-        newGame();
+        // only the new engines need resetting, the rest keep what they have
+        const int kept = resizePool();
+        for(int i = kept; i < threadCount; i++) {
+            engines[i].startReset();
+        }
         //clock_t end = clock();
         //std::cout << "operation took " << std::to_string((end-start)/static_cast<double>(1000)) << std::endl;
+    } else if(name == "EvalCache") {
+        evalCacheSize = std::stoi(bits[4]);
+        waitForClears();
+        for(auto &engine : engines) {
+            engine.evalCache.resize(evalCacheSize);
+        }
     } else if(name == "MoveOverhead") {
         moveOverhead = std::stoi(bits[4]);
     } else if(name == "SyzygyPath") {
         bool initSuccess = tb_init(bits[4].c_str());
         useSyzygy = initSuccess;
+    } else if(name == "EvalFile") {
+        // paths can have spaces in them
+        std::string path = bits.size() > 4 ? bits[4] : "";
+        for(int i = 5; i < std::ssize(bits); i++) {
+            path += " " + bits[i];
+        }
+        if(loadNetwork(path)) {
+            // the board's accumulators and the evals in the tt came from the old network, so it's a new game
+            newGame();
+            std::cout << "info string using network " << networkName() << std::endl;
+        }
     } else {
         adjustTunable(name, std::stod(bits[4]));
     }
@@ -118,10 +272,13 @@ void loadPosition(const std::vector<std::string>& bits) {
 void identify() {
     std::cout << "id name Clarity V7.2.0" << std::endl;
     std::cout << "id author Vast" << std::endl;
+    std::cout << "info string using " << kernels->name << " kernels and " << sliderPath() << " sliders" << std::endl;
     std::cout << "option name Hash type spin default 64 min 1 max 524288" << std::endl;
     std::cout << "option name Threads type spin default 1 min 1 max 16384" << std::endl;
+    std::cout << "option name EvalCache type spin default " << EvalCache::defaultSizeMB << " min 0 max 1024" << std::endl;
     std::cout << "option name MoveOverhead type spin default 10 min 1 max 100000" << std::endl;
     std::cout << "option name SyzygyPath type string default <empty>" << std::endl;
+    std::cout << "option name EvalFile type string default <embedded>" << std::endl;
     //outputTunables();
     std::cout << "uciok" << std::endl;
 }
@@ -170,6 +327,9 @@ void go(std::vector<std::string> bits) {
             }
         }
     }
+    // new search, so entries from before this are now older
+    TT.waitForClear();
+    TT.incrementAge();
     int time = 0;
     int depth = 0;
     int inc = 0;
@@ -207,6 +367,7 @@ void go(std::vector<std::string> bits) {
     if(depth != 0) {
         for(int i = 0; i < threadCount; i++) {
             threads.emplace_back([depth, i]{
+                engines[i].waitForReset();
                 engines[i].fixedDepthSearch(board, depth, i == 0);
             });
         }
@@ -214,12 +375,14 @@ void go(std::vector<std::string> bits) {
     } else if(nodes != 0) {
         for(int i = 0; i < threadCount; i++) {
             threads.emplace_back([nodes, i]{
+                engines[i].waitForReset();
                 engines[i].fixedNodesSearch(board, nodes, i == 0);
             });
         }
     } else if(infinite) {
         for(int i = 0; i < threadCount; i++) {
             threads.emplace_back([i]{
+                engines[i].waitForReset();
                 engines[i].fixedDepthSearch(board, 100, i == 0);
             });
         }
@@ -231,6 +394,7 @@ void go(std::vector<std::string> bits) {
         const int hardBound = time / tmhDivisor.value;
         for(int i = 0; i < threadCount; i++) {
             threads.emplace_back([i, softBound, hardBound]{
+                engines[i].waitForReset();
                 engines[i].think(board, softBound, hardBound, i == 0);
             });
         }
@@ -266,7 +430,13 @@ void interpretCommand(std::string command) {
 
     if(bits.empty()) {
         return;
-    } else if(bits[0] == "printstate") {
+    }
+    // go only waits for each thread's own engine, these don't touch the engines or the TT at all, and everything else waits for all of it
+    // isready waits too, since it's where a gui expects the engine to take its time, and anything left for go would come off the clock
+    if(bits[0] != "go" && bits[0] != "position" && bits[0] != "uci" && bits[0] != "stop" && bits[0] != "ucinewgame") {
+        waitForClears();
+    }
+    if(bits[0] == "printstate") {
         board.toString();
     } else if(bits[0] == "position") {
         loadPosition(bits);
@@ -301,6 +471,64 @@ void interpretCommand(std::string command) {
         } else {
             runBench(std::stoi(bits[1]));
         }
+    } else if(bits[0] == "savehash") {
+        if(bits.size() < 2) {
+            std::cout << "usage: savehash <file>\n";
+        } else if(TT.save(bits[1])) {
+            std::cout << "saved hash to " << bits[1] << '\n';
+        }
+    } else if(bits[0] == "loadhash") {
+        if(bits.size() < 2) {
+            std::cout << "usage: loadhash <file>\n";
+        } else if(TT.load(bits[1])) {
+            std::cout << "loaded hash from " << bits[1] << '\n';
+        }
+    } else if(bits[0] == "ttstats") {
+        printTTStats();
+    } else if(bits[0] == "memoryinfo") {
+        printMemoryInfo();
+    } else if(bits[0] == "updatebench") {
+        runUpdateBench();
+    } else if(bits[0] == "refreshbench") {
+        runRefreshBench();
+    } else if(bits[0] == "evalbench") {
+        runEvalBench();
+    } else if(bits[0] == "layoutcheck") {
+        runLayoutCheck();
+    } else if(bits[0] == "activationdensity") {
+        printActivationDensity();
+    } else if(bits[0] == "evalbatch") {
+        if(bits.size() < 3) {
+            std::cout << "usage: evalbatch <in.epd> <out>\n";
+        } else {
+            evalBatchFile(bits[1], bits[2], threadCount);
+        }
+    } else if(bits[0] == "nnuecheck") {
+        nnueCheck(board, bits.size() > 1 ? std::stoi(bits[1]) : 4);
+    } else if(bits[0] == "attackbench") {
+        attackMapBench();
+    } else if(bits[0] == "sliderbench") {
+        sliderBench();
+    } else if(bits[0] == "startuptime") {
+        printStartupTime();
+    } else if(bits[0] == "threatcheck") {
+        threatCheck(board, bits.size() > 1 ? std::stoi(bits[1]) : 4);
+    } else if(bits[0] == "ttstress") {
+        const int threadCount = bits.size() > 1 ? std::stoi(bits[1]) : std::max(2u, std::thread::hardware_concurrency());
+        const int seconds = bits.size() > 2 ? std::stoi(bits[2]) : 5;
+        ttStress(threadCount, seconds);
+    } else if(bits[0] == "ttbench") {
+        if(bits.size() == 1) {
+            runTTBench(12);
+        } else {
+            runTTBench(std::stoi(bits[1]));
+        }
+    } else if(bits[0] == "weightsbench") {
+        if(bits.size() == 1) {
+            runWeightsBench(12);
+        } else {
+            runWeightsBench(std::stoi(bits[1]));
+        }
     } else if(bits[0] == "makemove") {
         board.makeMove<true>(Move(bits[1], board));
     } else if(bits[0] == "undomove") {
@@ -327,10 +555,14 @@ void interpretCommand(std::string command) {
 }
 
 int main(int argc, char* argv[]) {
+    startupStamps[0] = std::chrono::steady_clock::now();
     initialize();
+    startupStamps[1] = std::chrono::steady_clock::now();
     newGame();
+    startupStamps[2] = std::chrono::steady_clock::now();
     std::cout << std::boolalpha;
     if(argc > 1 && std::string(argv[1]) == "bench") {
+        waitForClears();
         runBench(14);
         return 0;
     }